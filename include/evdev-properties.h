@@ -57,8 +57,8 @@
 #define EVDEV_PROP_INVERT_AXES "Evdev Axis Inversion"
 
 /* Reopen attempts. */
-/* CARD8 */
-#define EVDEV_PROP_REOPEN "Evdev Reopen Attempts" /* OBSOLETE */
+/* CARD8, 0 disables reopening */
+#define EVDEV_PROP_REOPEN "Evdev Reopen Attempts"
 
 /* Run-time calibration */
 /* CARD32, 4 values [minx, maxx, miny, maxy], or no values for unset */
@@ -93,4 +93,34 @@
 /* INT32, 3 values (vertical, horizontal, dial) */
 #define EVDEV_PROP_SCROLL_DISTANCE "Evdev Scrolling Distance"
 
+/* Hysteresis */
+/* INT32, 2 values [x, y], in device units, 0 to disable */
+#define EVDEV_PROP_HYSTERESIS "Evdev Axis Hysteresis"
+
+/* Filtering of absolute axes other than x/y */
+/* INT32, 3 values [deadzone, minimum change, maximum rate in Hz],
+   0 to disable a value */
+#define EVDEV_PROP_AUX_FILTER "Evdev Auxiliary Axis Filter"
+
+/* Pressure response curve */
+/* INT32, 4 values [x1, y1, x2, y2], the control points of a Bézier curve
+   from (0, 0) to (100, 100) */
+#define EVDEV_PROP_PRESSURE_CURVE "Evdev Pressure Curve"
+
+/* Motion prediction */
+/* INT32, 1 value, ms to extrapolate absolute motion by, 0 disables */
+#define EVDEV_PROP_PREDICTION "Evdev Motion Prediction"
+
+/* Event latency */
+/* CARDINAL, 8 values, number of frames processed 0, 1, 2-3, 4-7, 8-15,
+   16-31, 32-63 and 64 or more ms after their kernel timestamp */
+#define EVDEV_PROP_LATENCY "Evdev Latency Histogram"
+
+/* Palm rejection */
+/* INT32, 3 values [touch major, pressure, max touches], 0 to disable a value */
+#define EVDEV_PROP_PALM "Evdev Palm Rejection"
+/* CARD32, 3 values [rejected by size, by pressure, by touch count],
+   updated when read, write to reset */
+#define EVDEV_PROP_PALM_REJECTED "Evdev Palm Rejection Counters"
+
 #endif
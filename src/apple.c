@@ -34,7 +34,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <unistd.h>
+#include <sys/inotify.h>
 
 #include <exevents.h>
 #include <xf86.h>
@@ -76,13 +78,21 @@
 #define USB_DEVICE_ID_APPLE_ALU_WIRELESS_2009_ISO       0x023a
 #define USB_DEVICE_ID_APPLE_ALU_WIRELESS_2009_JIS       0x023b
 
-static int EvdevAppleGetProperty (DeviceIntPtr dev, Atom property);
-static int EvdevAppleSetProperty(DeviceIntPtr dev, Atom atom,
+static int EvdevAppleGetProperty (DeviceIntPtr dev);
+static int EvdevAppleSetProperty(DeviceIntPtr dev,
                       XIPropertyValuePtr val, BOOL checkonly);
 
+static const EvdevPropDesc fkeymode_desc =
+    { XA_INTEGER, 8, 1, 1, 0, 1, EvdevAppleSetProperty, EvdevAppleGetProperty };
+
 static Atom prop_fkeymode;
 static Bool fnmode_readonly; /* set if we can only read fnmode */
 
+/* fnmode is cached and re-read only after inotify saw it being written.
+ * Without the watch it is read on every property access. */
+static int fnmode_watch = -1;
+static enum fkeymode fnmode_cached = FKEYMODE_UNKNOWN;
+
 struct product_table
 {
     unsigned int vendor;
@@ -202,13 +212,98 @@ err:
 }
 
 /**
- * Set the property value to fkeymode. If the property doesn't exist,
- * initialize it.
+ * Drop the cached fnmode if it was written since it was read.
  */
-static void set_fkeymode_property(InputInfoPtr pInfo, enum fkeymode fkeymode)
+static void
+fnmode_check_watch(void)
+{
+    char buf[sizeof(struct inotify_event) + NAME_MAX + 1];
+
+    while (read(fnmode_watch, buf, sizeof(buf)) > 0)
+        fnmode_cached = FKEYMODE_UNKNOWN;
+}
+
+#if HAVE_THREADED_INPUT
+static void
+fnmode_notify(int fd, int ready, void *data)
+{
+    fnmode_check_watch();
+}
+#endif
+
+static void
+fnmode_watch_init(void)
+{
+    if (fnmode_watch >= 0)
+        return;
+
+    fnmode_watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fnmode_watch < 0)
+        return;
+
+    if (inotify_add_watch(fnmode_watch, FNMODE_PATH, IN_MODIFY) < 0)
+        goto err;
+
+#if HAVE_THREADED_INPUT
+    if (!SetNotifyFd(fnmode_watch, fnmode_notify, X_NOTIFY_READ, NULL))
+        goto err;
+#endif
+
+    return;
+
+err:
+    close(fnmode_watch);
+    fnmode_watch = -1;
+}
+
+/**
+ * @return the current fnmode, from the cache if it is still valid
+ */
+static enum fkeymode
+get_fnmode_cached(void)
+{
+    if (fnmode_watch < 0)
+        return get_fnmode();
+
+#if !HAVE_THREADED_INPUT
+    /* no notification from the server, check the watch ourselves */
+    fnmode_check_watch();
+#endif
+
+    if (fnmode_cached == FKEYMODE_UNKNOWN)
+        fnmode_cached = get_fnmode();
+
+    return fnmode_cached;
+}
+
+/**
+ * Write fnmode unless it already has this value.
+ *
+ * @return 0 on success, -1 otherwise (check errno)
+ */
+static int
+set_fnmode_cached(enum fkeymode fkeymode)
+{
+    if (fnmode_watch >= 0 && fkeymode == get_fnmode_cached())
+        return 0;
+
+    if (set_fnmode(fkeymode) < 0)
+        return -1;
+
+    /* our own write invalidates the cache through the watch again, but
+     * the value is known until then */
+    fnmode_cached = fkeymode;
+    return 0;
+}
+
+/**
+ * Set the property value to fkeymode. If init is set, the property is
+ * created.
+ */
+static void set_fkeymode_property(InputInfoPtr pInfo, enum fkeymode fkeymode,
+                                  BOOL init)
 {
     DeviceIntPtr dev = pInfo->dev;
-    BOOL init = FALSE;
     char data;
 
     switch(fkeymode)
@@ -220,75 +315,57 @@ static void set_fkeymode_property(InputInfoPtr pInfo, enum fkeymode fkeymode)
             return;
     }
 
-    if (!prop_fkeymode) {
-        init = TRUE;
-        prop_fkeymode = MakeAtom(EVDEV_PROP_FUNCTION_KEYS, strlen(EVDEV_PROP_FUNCTION_KEYS), TRUE);
-    }
-
     /* Don't send an event if we're initializing the property */
     XIChangeDeviceProperty(dev, prop_fkeymode, XA_INTEGER, 8,
                            PropModeReplace, 1, &data, !init);
 
     if (init)
-    {
         XISetDevicePropertyDeletable(dev, prop_fkeymode, FALSE);
-        XIRegisterPropertyHandler(dev, EvdevAppleSetProperty, EvdevAppleGetProperty, NULL);
-    }
 }
 
 
 /**
  * Called when a client reads the property state.
  * Update with current kernel state, it may have changed behind our back.
+ * The state is cached while nobody writes to fnmode, so this usually
+ * doesn't touch sysfs.
  */
 static int
-EvdevAppleGetProperty (DeviceIntPtr dev, Atom property)
+EvdevAppleGetProperty (DeviceIntPtr dev)
 {
-    if (property == prop_fkeymode)
-    {
-        InputInfoPtr pInfo  = dev->public.devicePrivate;
-        EvdevPtr     pEvdev = pInfo->private;
-        enum fkeymode fkeymode;
-
-        fkeymode = get_fnmode();
-        if (fkeymode != pEvdev->fkeymode) {
-            /* set internal copy first, so we don't write to the file in
-             * SetProperty handler */
-            pEvdev->fkeymode = fkeymode;
-            set_fkeymode_property(pInfo, fkeymode);
-        }
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
+    enum fkeymode fkeymode;
+
+    fkeymode = get_fnmode_cached();
+    if (fkeymode != pEvdev->fkeymode) {
+        /* set internal copy first, so we don't write to the file in
+         * SetProperty handler */
+        pEvdev->fkeymode = fkeymode;
+        set_fkeymode_property(pInfo, fkeymode, FALSE);
     }
+
     return Success;
 }
 
 static int
-EvdevAppleSetProperty(DeviceIntPtr dev, Atom atom,
+EvdevAppleSetProperty(DeviceIntPtr dev,
                       XIPropertyValuePtr val, BOOL checkonly)
 {
     InputInfoPtr pInfo  = dev->public.devicePrivate;
     EvdevPtr pEvdev = pInfo->private;
+    CARD8 v = *(CARD8*)val->data;
 
-    if (atom == prop_fkeymode)
-    {
-        CARD8 v = *(CARD8*)val->data;
-
-        if (val->format != 8 || val->type != XA_INTEGER)
-            return BadMatch;
+    if (fnmode_readonly)
+        return BadAccess;
 
-        if (fnmode_readonly)
-            return BadAccess;
-
-        if (v > 1)
-            return BadValue;
-
-        if (!checkonly)
+    if (!checkonly)
+    {
+        if ((!v && pEvdev->fkeymode != FKEYMODE_FKEYS) ||
+            (v && pEvdev->fkeymode != FKEYMODE_MMKEYS))
         {
-            if ((!v && pEvdev->fkeymode != FKEYMODE_FKEYS) ||
-                (v && pEvdev->fkeymode != FKEYMODE_MMKEYS))
-            {
-                pEvdev->fkeymode = v ? FKEYMODE_MMKEYS : FKEYMODE_FKEYS;
-                set_fnmode(pEvdev->fkeymode);
-            }
+            pEvdev->fkeymode = v ? FKEYMODE_MMKEYS : FKEYMODE_FKEYS;
+            set_fnmode_cached(pEvdev->fkeymode);
         }
     }
 
@@ -307,7 +384,26 @@ EvdevAppleInitProperty(DeviceIntPtr dev)
                        libevdev_get_id_product(pEvdev->dev)))
         return;
 
-    fkeymode = get_fnmode();
+    fnmode_watch_init();
+
+    EvdevInternAtom(&prop_fkeymode, EVDEV_PROP_FUNCTION_KEYS);
+    EvdevRegisterProperty(dev, prop_fkeymode, &fkeymode_desc);
+
+    fkeymode = get_fnmode_cached();
     pEvdev->fkeymode = fkeymode;
-    set_fkeymode_property(pInfo, fkeymode);
+    set_fkeymode_property(pInfo, fkeymode, TRUE);
+}
+
+void
+EvdevAppleFini(void)
+{
+    if (fnmode_watch < 0)
+        return;
+
+#if HAVE_THREADED_INPUT
+    RemoveNotifyFd(fnmode_watch);
+#endif
+    close(fnmode_watch);
+    fnmode_watch = -1;
+    fnmode_cached = FKEYMODE_UNKNOWN;
 }
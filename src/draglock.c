@@ -37,6 +37,7 @@
 #endif
 #include "evdev.h"
 
+#include <limits.h>
 #include <xf86.h>
 #include <xf86Xinput.h>
 #include <X11/Xatom.h>
@@ -48,6 +49,23 @@ static Atom prop_dlock     = 0; /* Drag lock buttons. */
 
 void EvdevDragLockLockButton(InputInfoPtr pInfo, unsigned int button);
 
+/* Allocate the per-button state, only devices using drag lock need it */
+static BOOL
+EvdevDragLockAlloc(EvdevPtr pEvdev)
+{
+    if (pEvdev->dragLock.lock_pair)
+        return TRUE;
+
+    pEvdev->dragLock.lock_pair = calloc(EVDEV_MAXBUTTONS,
+                                        sizeof(unsigned int) + sizeof(BOOL));
+    if (!pEvdev->dragLock.lock_pair)
+        return FALSE;
+
+    pEvdev->dragLock.lock_state =
+        (BOOL*)(pEvdev->dragLock.lock_pair + EVDEV_MAXBUTTONS);
+    return TRUE;
+}
+
 
 /* Setup and configuration code */
 void
@@ -66,6 +84,12 @@ EvdevDragLockPreInit(InputInfoPtr pInfo)
     if (!option_string)
         return;
 
+    if (!EvdevDragLockAlloc(pEvdev)) {
+        xf86IDrvMsg(pInfo, X_ERROR, "DragLockButtons : out of memory\n");
+        free(option_string);
+        return;
+    }
+
     next_num = option_string;
 
     /* Loop until we hit the end of our option string */
@@ -147,6 +171,16 @@ EvdevDragLockPreInit(InputInfoPtr pInfo)
     free(option_string);
 }
 
+void
+EvdevDragLockFree(InputInfoPtr pInfo)
+{
+    EvdevPtr pEvdev = (EvdevPtr)pInfo->private;
+
+    free(pEvdev->dragLock.lock_pair);
+    pEvdev->dragLock.lock_pair = NULL;
+    pEvdev->dragLock.lock_state = NULL;
+}
+
 /* Updates DragLock button state and fires button event messges */
 void
 EvdevDragLockLockButton(InputInfoPtr pInfo, unsigned int button)
@@ -174,7 +208,7 @@ EvdevDragLockFilterEvent(InputInfoPtr pInfo, unsigned int button, int value)
 {
     EvdevPtr pEvdev = (EvdevPtr)pInfo->private;
 
-    if (button == 0)
+    if (button == 0 || !pEvdev->dragLock.lock_pair)
         return FALSE;
 
     /* Do we have a single meta key or
@@ -217,67 +251,71 @@ EvdevDragLockFilterEvent(InputInfoPtr pInfo, unsigned int button, int value)
  * i.e. to set bt 3 to draglock button 1, supply 0,0,1
  */
 static int
-EvdevDragLockSetProperty(DeviceIntPtr dev, Atom atom, XIPropertyValuePtr val,
+EvdevDragLockSetProperty(DeviceIntPtr dev, XIPropertyValuePtr val,
                          BOOL checkonly)
 {
     InputInfoPtr pInfo  = dev->public.devicePrivate;
     EvdevPtr     pEvdev = pInfo->private;
+    int i;
 
-    if (atom == prop_dlock)
+    /* Don't allow changes while a lock is active */
+    if (pEvdev->dragLock.meta)
     {
-        int i;
+        if (pEvdev->dragLock.meta_state)
+            return BadAccess;
+    } else if (pEvdev->dragLock.lock_state)
+    {
+        for (i = 0; i < EVDEV_MAXBUTTONS; i++)
+            if (pEvdev->dragLock.lock_state[i])
+                return BadValue;
+    }
 
-        if (val->format != 8 || val->type != XA_INTEGER)
-            return BadMatch;
+    if (val->size == 1)
+    {
+        int meta = *((CARD8*)val->data);
+        if (meta > EVDEV_MAXBUTTONS)
+            return BadValue;
 
-        /* Don't allow changes while a lock is active */
-        if (pEvdev->dragLock.meta)
+        if (!checkonly)
         {
-            if (pEvdev->dragLock.meta_state)
-                return BadAccess;
-        } else
-        {
-            for (i = 0; i < EVDEV_MAXBUTTONS; i++)
-                if (pEvdev->dragLock.lock_state[i])
-                    return BadValue;
+            if (meta && !EvdevDragLockAlloc(pEvdev))
+                return BadAlloc;
+
+            pEvdev->dragLock.meta = meta;
+            if (pEvdev->dragLock.lock_pair)
+                memset(pEvdev->dragLock.lock_pair, 0,
+                       EVDEV_MAXBUTTONS * sizeof(unsigned int));
         }
+    } else if ((val->size % 2) == 0)
+    {
+        CARD8* vals = (CARD8*)val->data;
 
-        if (val->size == 0)
-            return BadMatch;
-        else if (val->size == 1)
-        {
-            int meta = *((CARD8*)val->data);
-            if (meta > EVDEV_MAXBUTTONS)
+        for (i = 0; i < val->size && i < EVDEV_MAXBUTTONS; i++)
+            if (vals[i] > EVDEV_MAXBUTTONS)
                 return BadValue;
 
-            if (!checkonly)
-            {
-                pEvdev->dragLock.meta = meta;
-                memset(pEvdev->dragLock.lock_pair, 0, sizeof(pEvdev->dragLock.lock_pair));
-            }
-        } else if ((val->size % 2) == 0)
+        if (!checkonly)
         {
-            CARD8* vals = (CARD8*)val->data;
-
-            for (i = 0; i < val->size && i < EVDEV_MAXBUTTONS; i++)
-                if (vals[i] > EVDEV_MAXBUTTONS)
-                    return BadValue;
+            if (!EvdevDragLockAlloc(pEvdev))
+                return BadAlloc;
 
-            if (!checkonly)
-            {
-                pEvdev->dragLock.meta = 0;
-                memset(pEvdev->dragLock.lock_pair, 0, sizeof(pEvdev->dragLock.lock_pair));
+            pEvdev->dragLock.meta = 0;
+            memset(pEvdev->dragLock.lock_pair, 0,
+                   EVDEV_MAXBUTTONS * sizeof(unsigned int));
 
-                for (i = 0; i < val->size && i < EVDEV_MAXBUTTONS; i += 2)
-                    pEvdev->dragLock.lock_pair[vals[i] - 1] = vals[i + 1];
-            }
-        } else
-            return BadMatch;
-    }
+            for (i = 0; i < val->size && i < EVDEV_MAXBUTTONS; i += 2)
+                pEvdev->dragLock.lock_pair[vals[i] - 1] = vals[i + 1];
+        }
+    } else
+        return BadMatch;
 
     return Success;
 }
 
+/* either 1 value or pairs, the values are checked above */
+static const EvdevPropDesc dlock_desc =
+    { XA_INTEGER, 8, 1, INT_MAX, 0, 0, EvdevDragLockSetProperty, NULL };
+
 /**
  * Initialise property for drag lock buttons setting.
  */
@@ -290,7 +328,8 @@ EvdevDragLockInitProperty(DeviceIntPtr dev)
     if (!dev->button) /* don't init prop for keyboards */
         return;
 
-    prop_dlock = MakeAtom(EVDEV_PROP_DRAGLOCK, strlen(EVDEV_PROP_DRAGLOCK), TRUE);
+    EvdevInternAtom(&prop_dlock, EVDEV_PROP_DRAGLOCK);
+    EvdevRegisterProperty(dev, prop_dlock, &dlock_desc);
     if (pEvdev->dragLock.meta)
     {
         XIChangeDeviceProperty(dev, prop_dlock, XA_INTEGER, 8,
@@ -301,7 +340,7 @@ EvdevDragLockInitProperty(DeviceIntPtr dev)
         int i;
         CARD8 pair[EVDEV_MAXBUTTONS] = {0};
 
-        for (i = 0; i < EVDEV_MAXBUTTONS; i++)
+        for (i = 0; pEvdev->dragLock.lock_pair && i < EVDEV_MAXBUTTONS; i++)
         {
             if (pEvdev->dragLock.lock_pair[i])
                 highest = i;
@@ -313,6 +352,4 @@ EvdevDragLockInitProperty(DeviceIntPtr dev)
     }
 
     XISetDevicePropertyDeletable(dev, prop_dlock, FALSE);
-
-    XIRegisterPropertyHandler(dev, EvdevDragLockSetProperty, NULL, NULL);
 }
@@ -353,44 +353,49 @@ EvdevMBEmuFinalize(InputInfoPtr pInfo)
 }
 
 static int
-EvdevMBEmuSetProperty(DeviceIntPtr dev, Atom atom, XIPropertyValuePtr val,
-                      BOOL checkonly)
+EvdevMBEmuSetEnabled(DeviceIntPtr dev, XIPropertyValuePtr val, BOOL checkonly)
 {
     InputInfoPtr pInfo  = dev->public.devicePrivate;
     EvdevPtr     pEvdev = pInfo->private;
-    int bt;
 
-    if (atom == prop_mbemu)
-    {
-        if (val->format != 8 || val->size != 1 || val->type != XA_INTEGER)
-            return BadMatch;
+    if (!checkonly)
+        pEvdev->emulateMB.enabled = *((BOOL*)val->data);
 
-        if (!checkonly)
-            pEvdev->emulateMB.enabled = *((BOOL*)val->data);
-    } else if (atom == prop_mbtimeout)
-    {
-        if (val->format != 32 || val->size != 1 || val->type != XA_INTEGER)
-            return BadMatch;
+    return Success;
+}
 
-        if (!checkonly)
-            pEvdev->emulateMB.timeout = *((CARD32*)val->data);
-    } else if (atom == prop_mbbuton)
-    {
-        if (val->format != 8 || val->size != 1 || val->type != XA_INTEGER)
-            return BadMatch;
+static int
+EvdevMBEmuSetTimeout(DeviceIntPtr dev, XIPropertyValuePtr val, BOOL checkonly)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
 
-        bt = *((CARD8*)val->data);
+    if (!checkonly)
+        pEvdev->emulateMB.timeout = *((CARD32*)val->data);
 
-        if (bt < 0 || bt > EVDEV_MAXBUTTONS)
-            return BadValue;
+    return Success;
+}
 
-        if (!checkonly)
-            pEvdev->emulateMB.button = bt;
-    }
+static int
+EvdevMBEmuSetButton(DeviceIntPtr dev, XIPropertyValuePtr val, BOOL checkonly)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
+
+    if (!checkonly)
+        pEvdev->emulateMB.button = *((CARD8*)val->data);
 
     return Success;
 }
 
+/* type, format, min/max size, min/max value, set, get */
+static const EvdevPropDesc mbemu_desc =
+    { XA_INTEGER, 8, 1, 1, 0, 0, EvdevMBEmuSetEnabled, NULL };
+static const EvdevPropDesc mbtimeout_desc =
+    { XA_INTEGER, 32, 1, 1, 0, 0, EvdevMBEmuSetTimeout, NULL };
+static const EvdevPropDesc mbbutton_desc =
+    { XA_INTEGER, 8, 1, 1, 0, EVDEV_MAXBUTTONS, EvdevMBEmuSetButton, NULL };
+
 /**
  * Initialise property for MB emulation on/off.
  */
@@ -404,7 +409,8 @@ EvdevMBEmuInitProperty(DeviceIntPtr dev)
     if (!dev->button) /* don't init prop for keyboards */
         return;
 
-    prop_mbemu = MakeAtom(EVDEV_PROP_MIDBUTTON, strlen(EVDEV_PROP_MIDBUTTON), TRUE);
+    EvdevInternAtom(&prop_mbemu, EVDEV_PROP_MIDBUTTON);
+    EvdevRegisterProperty(dev, prop_mbemu, &mbemu_desc);
     rc = XIChangeDeviceProperty(dev, prop_mbemu, XA_INTEGER, 8,
                                 PropModeReplace, 1,
                                 &pEvdev->emulateMB.enabled,
@@ -413,9 +419,8 @@ EvdevMBEmuInitProperty(DeviceIntPtr dev)
         return;
     XISetDevicePropertyDeletable(dev, prop_mbemu, FALSE);
 
-    prop_mbtimeout = MakeAtom(EVDEV_PROP_MIDBUTTON_TIMEOUT,
-                              strlen(EVDEV_PROP_MIDBUTTON_TIMEOUT),
-                              TRUE);
+    EvdevInternAtom(&prop_mbtimeout, EVDEV_PROP_MIDBUTTON_TIMEOUT);
+    EvdevRegisterProperty(dev, prop_mbtimeout, &mbtimeout_desc);
     rc = XIChangeDeviceProperty(dev, prop_mbtimeout, XA_INTEGER, 32, PropModeReplace, 1,
                                 &pEvdev->emulateMB.timeout, FALSE);
 
@@ -423,15 +428,12 @@ EvdevMBEmuInitProperty(DeviceIntPtr dev)
         return;
     XISetDevicePropertyDeletable(dev, prop_mbtimeout, FALSE);
 
-    prop_mbbuton = MakeAtom(EVDEV_PROP_MIDBUTTON_BUTTON,
-                              strlen(EVDEV_PROP_MIDBUTTON_BUTTON),
-                              TRUE);
+    EvdevInternAtom(&prop_mbbuton, EVDEV_PROP_MIDBUTTON_BUTTON);
+    EvdevRegisterProperty(dev, prop_mbbuton, &mbbutton_desc);
     rc = XIChangeDeviceProperty(dev, prop_mbbuton, XA_INTEGER, 8, PropModeReplace, 1,
                                 &pEvdev->emulateMB.button, FALSE);
 
     if (rc != Success)
         return;
     XISetDevicePropertyDeletable(dev, prop_mbbuton, FALSE);
-
-    XIRegisterPropertyHandler(dev, EvdevMBEmuSetProperty, NULL, NULL);
 }
@@ -315,49 +315,63 @@ Evdev3BEmuFinalize(InputInfoPtr pInfo)
 }
 
 static int
-Evdev3BEmuSetProperty(DeviceIntPtr dev, Atom atom, XIPropertyValuePtr val,
-                      BOOL checkonly)
+Evdev3BEmuSetEnabled(DeviceIntPtr dev, XIPropertyValuePtr val, BOOL checkonly)
 {
-    InputInfoPtr      pInfo  = dev->public.devicePrivate;
-    EvdevPtr          pEvdev = pInfo->private;
-    struct emulate3B *emu3B  = &pEvdev->emulate3B;
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
 
-    if (atom == prop_3bemu)
-    {
-        if (val->format != 8 || val->size != 1 || val->type != XA_INTEGER)
-            return BadMatch;
+    if (!checkonly)
+        pEvdev->emulate3B.enabled = *((BOOL*)val->data);
 
-        if (!checkonly)
-            emu3B->enabled = *((BOOL*)val->data);
+    return Success;
+}
 
-    } else if (atom == prop_3btimeout)
-    {
-        if (val->format != 32 || val->size != 1 || val->type != XA_INTEGER)
-            return BadMatch;
+static int
+Evdev3BEmuSetTimeout(DeviceIntPtr dev, XIPropertyValuePtr val, BOOL checkonly)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
 
-        if (!checkonly)
-            emu3B->timeout = *((CARD32*)val->data);
+    if (!checkonly)
+        pEvdev->emulate3B.timeout = *((CARD32*)val->data);
 
-    } else if (atom == prop_3bbutton)
-    {
-        if (val->format != 8 || val->size != 1 || val->type != XA_INTEGER)
-            return BadMatch;
+    return Success;
+}
 
-        if (!checkonly)
-            emu3B->button = *((CARD8*)val->data);
-    } else if (atom == prop_3bthreshold)
-    {
-        if (val->format != 32 || val->size != 1 || val->type != XA_INTEGER)
-            return BadMatch;
+static int
+Evdev3BEmuSetButton(DeviceIntPtr dev, XIPropertyValuePtr val, BOOL checkonly)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
 
-        if (!checkonly)
-            emu3B->threshold = *((CARD32*)val->data);
-    }
+    if (!checkonly)
+        pEvdev->emulate3B.button = *((CARD8*)val->data);
+
+    return Success;
+}
+
+static int
+Evdev3BEmuSetThreshold(DeviceIntPtr dev, XIPropertyValuePtr val, BOOL checkonly)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
 
+    if (!checkonly)
+        pEvdev->emulate3B.threshold = *((CARD32*)val->data);
 
     return Success;
 }
 
+/* type, format, min/max size, min/max value, set, get */
+static const EvdevPropDesc emu3b_desc =
+    { XA_INTEGER, 8, 1, 1, 0, 0, Evdev3BEmuSetEnabled, NULL };
+static const EvdevPropDesc emu3b_timeout_desc =
+    { XA_INTEGER, 32, 1, 1, 0, 0, Evdev3BEmuSetTimeout, NULL };
+static const EvdevPropDesc emu3b_button_desc =
+    { XA_INTEGER, 8, 1, 1, 0, 0, Evdev3BEmuSetButton, NULL };
+static const EvdevPropDesc emu3b_threshold_desc =
+    { XA_INTEGER, 32, 1, 1, 0, 0, Evdev3BEmuSetThreshold, NULL };
+
 /**
  * Initialise properties for third button emulation
  */
@@ -373,7 +387,8 @@ Evdev3BEmuInitProperty(DeviceIntPtr dev)
         return;
 
     /* third button emulation on/off */
-    prop_3bemu = MakeAtom(EVDEV_PROP_THIRDBUTTON, strlen(EVDEV_PROP_THIRDBUTTON), TRUE);
+    EvdevInternAtom(&prop_3bemu, EVDEV_PROP_THIRDBUTTON);
+    EvdevRegisterProperty(dev, prop_3bemu, &emu3b_desc);
     rc = XIChangeDeviceProperty(dev, prop_3bemu, XA_INTEGER, 8,
                                 PropModeReplace, 1,
                                 &emu3B->enabled,
@@ -384,9 +399,8 @@ Evdev3BEmuInitProperty(DeviceIntPtr dev)
     XISetDevicePropertyDeletable(dev, prop_3bemu, FALSE);
 
     /* third button emulation timeout */
-    prop_3btimeout = MakeAtom(EVDEV_PROP_THIRDBUTTON_TIMEOUT,
-                              strlen(EVDEV_PROP_THIRDBUTTON_TIMEOUT),
-                              TRUE);
+    EvdevInternAtom(&prop_3btimeout, EVDEV_PROP_THIRDBUTTON_TIMEOUT);
+    EvdevRegisterProperty(dev, prop_3btimeout, &emu3b_timeout_desc);
     rc = XIChangeDeviceProperty(dev, prop_3btimeout, XA_INTEGER, 32, PropModeReplace, 1,
                                 &emu3B->timeout, FALSE);
 
@@ -396,9 +410,8 @@ Evdev3BEmuInitProperty(DeviceIntPtr dev)
     XISetDevicePropertyDeletable(dev, prop_3btimeout, FALSE);
 
     /* third button emulation button to be triggered  */
-    prop_3bbutton = MakeAtom(EVDEV_PROP_THIRDBUTTON_BUTTON,
-                             strlen(EVDEV_PROP_THIRDBUTTON_BUTTON),
-                             TRUE);
+    EvdevInternAtom(&prop_3bbutton, EVDEV_PROP_THIRDBUTTON_BUTTON);
+    EvdevRegisterProperty(dev, prop_3bbutton, &emu3b_button_desc);
     rc = XIChangeDeviceProperty(dev, prop_3bbutton, XA_INTEGER, 8, PropModeReplace, 1,
                                 &emu3B->button, FALSE);
 
@@ -408,9 +421,8 @@ Evdev3BEmuInitProperty(DeviceIntPtr dev)
     XISetDevicePropertyDeletable(dev, prop_3bbutton, FALSE);
 
     /* third button emulation movement threshold */
-    prop_3bthreshold = MakeAtom(EVDEV_PROP_THIRDBUTTON_THRESHOLD,
-                                strlen(EVDEV_PROP_THIRDBUTTON_THRESHOLD),
-                                TRUE);
+    EvdevInternAtom(&prop_3bthreshold, EVDEV_PROP_THIRDBUTTON_THRESHOLD);
+    EvdevRegisterProperty(dev, prop_3bthreshold, &emu3b_threshold_desc);
     rc = XIChangeDeviceProperty(dev, prop_3bthreshold, XA_INTEGER, 32, PropModeReplace, 1,
                                 &emu3B->threshold, FALSE);
 
@@ -418,6 +430,4 @@ Evdev3BEmuInitProperty(DeviceIntPtr dev)
         return;
 
     XISetDevicePropertyDeletable(dev, prop_3bthreshold, FALSE);
-
-    XIRegisterPropertyHandler(dev, Evdev3BEmuSetProperty, NULL, NULL);
 }
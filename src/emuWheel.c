@@ -44,6 +44,11 @@
 
 #define WHEEL_NOT_CONFIGURED 0
 
+/* Kinetic scrolling: timer interval in ms, only samples within the window
+   before the button release count towards the velocity */
+#define KINETIC_INTERVAL 16
+#define KINETIC_WINDOW   100
+
 static Atom prop_wheel_emu      = 0;
 static Atom prop_wheel_axismap  = 0;
 static Atom prop_wheel_inertia  = 0;
@@ -51,7 +56,13 @@ static Atom prop_wheel_timeout  = 0;
 static Atom prop_wheel_button   = 0;
 
 /* Local Funciton Prototypes */
-static int EvdevWheelEmuInertia(InputInfoPtr pInfo, WheelAxisPtr axis, int value);
+static int EvdevWheelEmuInertia(InputInfoPtr pInfo, WheelAxisPtr axis, int value,
+                                BOOL queue);
+static BOOL EvdevWheelEmuScrollDelta(EvdevPtr pEvdev, WheelAxisPtr axis,
+                                     int value, int *map, double *delta);
+static BOOL EvdevWheelEmuSmoothScroll(InputInfoPtr pInfo, WheelAxisPtr axis, int value);
+static void EvdevWheelEmuKineticStart(InputInfoPtr pInfo);
+static void EvdevWheelEmuKineticStop(InputInfoPtr pInfo);
 
 /* Filter mouse button events */
 BOOL
@@ -68,11 +79,12 @@ EvdevWheelEmuFilterButton(InputInfoPtr pInfo, unsigned int button, int value)
     if (pEvdev->emulateWheel.button == button) {
 	pEvdev->emulateWheel.button_state = value;
 
-        if (value)
+        if (value) {
             /* Start the timer when the button is pressed */
             pEvdev->emulateWheel.expires = pEvdev->emulateWheel.timeout +
                                            GetTimeInMillis();
-        else {
+            EvdevWheelEmuKineticStop(pInfo);
+        } else {
             ms = pEvdev->emulateWheel.expires - GetTimeInMillis();
             if (ms > 0) {
                 /*
@@ -80,7 +92,8 @@ EvdevWheelEmuFilterButton(InputInfoPtr pInfo, unsigned int button, int value)
                  * press/release events
                  */
                 EvdevQueueButtonClicks(pInfo, button, 1);
-            }
+            } else
+                EvdevWheelEmuKineticStart(pInfo);
         }
 
 	return TRUE;
@@ -144,8 +157,16 @@ EvdevWheelEmuFilterMotion(InputInfoPtr pInfo, struct input_event *pEv)
 	/* If we found REL_X, REL_Y, ABS_X or ABS_Y then emulate a mouse
 	   wheel.
 	 */
-	if (pAxis)
-	    EvdevWheelEmuInertia(pInfo, pAxis, value);
+	if (pAxis) {
+	    if (pEvdev->emulateWheel.kinetic) {
+		pAxis->samples[pAxis->cur_sample].time = GetTimeInMillis();
+		pAxis->samples[pAxis->cur_sample].value = value;
+		pAxis->cur_sample = (pAxis->cur_sample + 1) % EVDEV_WHEEL_SAMPLES;
+	    }
+
+	    if (!EvdevWheelEmuSmoothScroll(pInfo, pAxis, value))
+		EvdevWheelEmuInertia(pInfo, pAxis, value, TRUE);
+	}
 
 	/* Eat motion events while emulateWheel button pressed. */
 	return TRUE;
@@ -155,10 +176,12 @@ EvdevWheelEmuFilterMotion(InputInfoPtr pInfo, struct input_event *pEv)
 }
 
 /* Simulate inertia for our emulated mouse wheel.
+   If queue is FALSE, the button events are posted immediately.
    Returns the number of wheel events generated.
  */
 static int
-EvdevWheelEmuInertia(InputInfoPtr pInfo, WheelAxisPtr axis, int value)
+EvdevWheelEmuInertia(InputInfoPtr pInfo, WheelAxisPtr axis, int value,
+                     BOOL queue)
 {
     EvdevPtr pEvdev = (EvdevPtr)pInfo->private;
     int button;
@@ -182,12 +205,230 @@ EvdevWheelEmuInertia(InputInfoPtr pInfo, WheelAxisPtr axis, int value)
     /* Produce button press events for wheel motion */
     while(abs(axis->traveled_distance) > pEvdev->emulateWheel.inertia) {
 	axis->traveled_distance -= inertia;
-	EvdevQueueButtonClicks(pInfo, button, 1);
+	if (queue)
+	    EvdevQueueButtonClicks(pInfo, button, 1);
+	else {
+	    EvdevPostButtonEvent(pInfo, button, BUTTON_PRESS);
+	    EvdevPostButtonEvent(pInfo, button, BUTTON_RELEASE);
+	}
 	rc++;
     }
     return rc;
 }
 
+/* Convert the motion into a delta on the scroll valuator for this axis.
+   Returns FALSE if the axis doesn't use the standard wheel buttons or the
+   device has no matching scroll valuator, the caller must then fall back
+   to button clicks.
+ */
+static BOOL
+EvdevWheelEmuScrollDelta(EvdevPtr pEvdev, WheelAxisPtr axis, int value,
+                         int *map, double *delta)
+{
+    int code, button, increment;
+
+    if (!pEvdev->emulateWheel.smooth)
+	return FALSE;
+
+    if (axis == &pEvdev->emulateWheel.Y) {
+	code = REL_WHEEL;
+	button = 4;
+	increment = -pEvdev->smoothScroll.vert_delta *
+		    pEvdev->smoothScroll.vert_units;
+    } else {
+	code = REL_HWHEEL;
+	button = 6;
+	increment = pEvdev->smoothScroll.horiz_delta *
+		    pEvdev->smoothScroll.horiz_units;
+    }
+
+    /* up_button is the negative direction, i.e. button 4 (up) or 6 (left).
+       Anything other than the standard buttons or their swapped
+       counterparts can only be done through button events */
+    if (axis->up_button == button + 1 && axis->down_button == button)
+	increment = -increment;
+    else if (axis->up_button != button || axis->down_button != button + 1)
+	return FALSE;
+
+    *map = pEvdev->rel_axis_map[code];
+    if (*map == -1)
+	return FALSE;
+
+    *delta = (double)value * increment / pEvdev->emulateWheel.inertia;
+
+    return TRUE;
+}
+
+/* Add the scroll valuator delta for this motion to the rel_vals of the
+   current frame, so any amount of motion results in one motion event at
+   EV_SYN time. The server takes care of emulating button events for
+   clients that don't do smooth scrolling.
+   Returns FALSE if the motion must be converted into button clicks.
+ */
+static BOOL
+EvdevWheelEmuSmoothScroll(InputInfoPtr pInfo, WheelAxisPtr axis, int value)
+{
+    EvdevPtr pEvdev = (EvdevPtr)pInfo->private;
+    int map;
+    double delta;
+
+    if (!pEvdev->rel_vals ||
+        !EvdevWheelEmuScrollDelta(pEvdev, axis, value, &map, &delta))
+	return FALSE;
+
+    axis->traveled_distance = 0;
+
+    if (valuator_mask_isset(pEvdev->rel_vals, map))
+	delta += valuator_mask_get_double(pEvdev->rel_vals, map);
+
+    valuator_mask_set_double(pEvdev->rel_vals, map, delta);
+    pEvdev->rel_queued = 1;
+
+    return TRUE;
+}
+
+/* Estimate the velocity of the axis at the time of the button release from
+   the motion samples within KINETIC_WINDOW.
+   Returns the velocity in 16.16 fixed-point units per ms, or 0 if the
+   device wasn't moving.
+ */
+static int
+EvdevWheelEmuVelocity(WheelAxisPtr axis, Time now)
+{
+    int i, idx;
+    int newest = (axis->cur_sample + EVDEV_WHEEL_SAMPLES - 1) % EVDEV_WHEEL_SAMPLES;
+    Time oldest_time = 0;
+    int64_t distance = 0;
+
+    if (!axis->samples[newest].time ||
+        now - axis->samples[newest].time > KINETIC_WINDOW)
+	return 0;
+
+    /* The oldest sample only provides the start time, its motion happened
+       before that */
+    for (i = 0; i < EVDEV_WHEEL_SAMPLES; i++) {
+	idx = (newest + EVDEV_WHEEL_SAMPLES - i) % EVDEV_WHEEL_SAMPLES;
+	if (!axis->samples[idx].time ||
+	    now - axis->samples[idx].time > KINETIC_WINDOW)
+	    break;
+
+	if (oldest_time)
+	    distance += axis->samples[(idx + 1) % EVDEV_WHEEL_SAMPLES].value;
+	oldest_time = axis->samples[idx].time;
+    }
+
+    if (axis->samples[newest].time == oldest_time)
+	return 0;
+
+    return (distance << 16) / (int)(axis->samples[newest].time - oldest_time);
+}
+
+/* Post one tick of kinetic motion for this axis and decelerate.
+   Returns TRUE if the axis is still moving.
+ */
+static BOOL
+EvdevWheelEmuKineticAxis(InputInfoPtr pInfo, WheelAxisPtr axis)
+{
+    EvdevPtr pEvdev = (EvdevPtr)pInfo->private;
+    int64_t distance;
+    int value, map;
+    double delta;
+
+    if (!axis->velocity)
+	return FALSE;
+
+    distance = (int64_t)axis->velocity * KINETIC_INTERVAL + axis->remainder;
+    value = distance / 65536;
+    axis->remainder = distance - (int64_t)value * 65536;
+
+    if (value) {
+	if (EvdevWheelEmuScrollDelta(pEvdev, axis, value, &map, &delta)) {
+	    valuator_mask_zero(pEvdev->emulateWheel.kinetic_vals);
+	    valuator_mask_set_double(pEvdev->emulateWheel.kinetic_vals, map, delta);
+	    xf86PostMotionEventM(pInfo->dev, Relative,
+	                         pEvdev->emulateWheel.kinetic_vals);
+	} else
+	    EvdevWheelEmuInertia(pInfo, axis, value, FALSE);
+    }
+
+    axis->velocity = ((int64_t)axis->velocity * pEvdev->emulateWheel.friction) >> 16;
+
+    /* Stop once we move less than one unit per tick */
+    if (abs(axis->velocity) * KINETIC_INTERVAL < 65536) {
+	axis->velocity = 0;
+	axis->remainder = 0;
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+static CARD32
+EvdevWheelEmuKineticTimer(OsTimerPtr timer, CARD32 time, pointer arg)
+{
+    InputInfoPtr pInfo = (InputInfoPtr)arg;
+    EvdevPtr pEvdev = (EvdevPtr)pInfo->private;
+    BOOL moving = FALSE;
+
+#if HAVE_THREADED_INPUT
+    input_lock();
+#else
+    int sigstate = xf86BlockSIGIO();
+#endif
+    if (pEvdev->emulateWheel.enabled) {
+	moving |= EvdevWheelEmuKineticAxis(pInfo, &pEvdev->emulateWheel.X);
+	moving |= EvdevWheelEmuKineticAxis(pInfo, &pEvdev->emulateWheel.Y);
+    }
+#if HAVE_THREADED_INPUT
+    input_unlock();
+#else
+    xf86UnblockSIGIO(sigstate);
+#endif
+
+    return moving ? KINETIC_INTERVAL : 0;
+}
+
+/* Called when the wheel button is released after emulating, keeps
+   scrolling with the release velocity until friction stops it. */
+static void
+EvdevWheelEmuKineticStart(InputInfoPtr pInfo)
+{
+    EvdevPtr pEvdev = (EvdevPtr)pInfo->private;
+    Time now = GetTimeInMillis();
+    WheelAxisPtr X = &pEvdev->emulateWheel.X,
+                 Y = &pEvdev->emulateWheel.Y;
+
+    if (!pEvdev->emulateWheel.kinetic || !pEvdev->emulateWheel.kinetic_vals)
+	return;
+
+    X->velocity = X->up_button ? EvdevWheelEmuVelocity(X, now) : 0;
+    Y->velocity = Y->up_button ? EvdevWheelEmuVelocity(Y, now) : 0;
+    X->remainder = 0;
+    Y->remainder = 0;
+
+    if (X->velocity || Y->velocity)
+	pEvdev->emulateWheel.kinetic_timer =
+	    TimerSet(pEvdev->emulateWheel.kinetic_timer, 0, KINETIC_INTERVAL,
+	             EvdevWheelEmuKineticTimer, pInfo);
+}
+
+static void
+EvdevWheelEmuKineticStop(InputInfoPtr pInfo)
+{
+    EvdevPtr pEvdev = (EvdevPtr)pInfo->private;
+
+    if (!pEvdev->emulateWheel.kinetic)
+	return;
+
+    if (pEvdev->emulateWheel.kinetic_timer)
+	TimerCancel(pEvdev->emulateWheel.kinetic_timer);
+
+    memset(pEvdev->emulateWheel.X.samples, 0,
+           2 * EVDEV_WHEEL_SAMPLES * sizeof(WheelSample));
+    pEvdev->emulateWheel.X.velocity = 0;
+    pEvdev->emulateWheel.Y.velocity = 0;
+}
+
 /* Handle button mapping here to avoid code duplication,
 returns true if a button mapping was found. */
 static BOOL
@@ -239,6 +480,33 @@ EvdevWheelEmuHandleButtonMap(InputInfoPtr pInfo, WheelAxisPtr pAxis,
     return FALSE;
 }
 
+/* Devices without a wheel don't have scroll valuators. If wheel emulation
+   is enabled in the config, add the wheel axes for the mapped directions
+   so the valuators exist when the device is initialized. */
+static void
+EvdevWheelEmuForceScrollAxes(InputInfoPtr pInfo)
+{
+    EvdevPtr pEvdev = (EvdevPtr)pInfo->private;
+
+    if (pEvdev->emulateWheel.Y.up_button &&
+        !libevdev_has_event_code(pEvdev->dev, EV_REL, REL_WHEEL))
+    {
+        libevdev_enable_event_code(pEvdev->dev, EV_REL, REL_WHEEL, NULL);
+        pEvdev->smoothScroll.vert_delta =
+            xf86SetIntOption(pInfo->options, "VertScrollDelta", 1);
+        xf86IDrvMsg(pInfo, X_INFO, "Adding vertical scroll axis for wheel emulation\n");
+    }
+
+    if (pEvdev->emulateWheel.X.up_button &&
+        !libevdev_has_event_code(pEvdev->dev, EV_REL, REL_HWHEEL))
+    {
+        libevdev_enable_event_code(pEvdev->dev, EV_REL, REL_HWHEEL, NULL);
+        pEvdev->smoothScroll.horiz_delta =
+            xf86SetIntOption(pInfo->options, "HorizScrollDelta", 1);
+        xf86IDrvMsg(pInfo, X_INFO, "Adding horizontal scroll axis for wheel emulation\n");
+    }
+}
+
 /* Setup the basic configuration options used by mouse wheel emulation */
 void
 EvdevWheelEmuPreInit(InputInfoPtr pInfo)
@@ -247,6 +515,7 @@ EvdevWheelEmuPreInit(InputInfoPtr pInfo)
     int wheelButton;
     int inertia;
     int timeout;
+    int friction;
 
     if (xf86SetBoolOption(pInfo->options, "EmulateWheel", FALSE)) {
 	pEvdev->emulateWheel.enabled = TRUE;
@@ -317,6 +586,45 @@ EvdevWheelEmuPreInit(InputInfoPtr pInfo)
     pEvdev->emulateWheel.X.traveled_distance = 0;
     pEvdev->emulateWheel.Y.traveled_distance = 0;
 
+    pEvdev->emulateWheel.smooth = xf86SetBoolOption(pInfo->options,
+                                                    "EmulateWheelSmoothScroll",
+                                                    TRUE);
+    if (pEvdev->emulateWheel.enabled && pEvdev->emulateWheel.smooth)
+        EvdevWheelEmuForceScrollAxes(pInfo);
+
+    pEvdev->emulateWheel.kinetic = xf86SetBoolOption(pInfo->options,
+                                                     "EmulateWheelKinetic",
+                                                     FALSE);
+    friction = xf86SetIntOption(pInfo->options, "EmulateWheelKineticFriction", 5);
+    if (friction <= 0 || friction >= 100) {
+        xf86IDrvMsg(pInfo, X_WARNING, "Invalid EmulateWheelKineticFriction value: %d\n",
+                    friction);
+        xf86IDrvMsg(pInfo, X_WARNING, "Using built-in friction value.\n");
+
+        friction = 5;
+    }
+    pEvdev->emulateWheel.friction = ((100 - friction) << 16) / 100;
+
+    if (pEvdev->emulateWheel.kinetic) {
+        /* one block for both axes */
+        pEvdev->emulateWheel.X.samples = calloc(2 * EVDEV_WHEEL_SAMPLES,
+                                                sizeof(WheelSample));
+        if (!pEvdev->emulateWheel.X.samples) {
+            xf86IDrvMsg(pInfo, X_ERROR, "Kinetic scrolling disabled, out of memory\n");
+            pEvdev->emulateWheel.kinetic = FALSE;
+        } else
+            pEvdev->emulateWheel.Y.samples =
+                pEvdev->emulateWheel.X.samples + EVDEV_WHEEL_SAMPLES;
+    }
+
+    if (pEvdev->emulateWheel.kinetic) {
+        /* allocate now so we don't allocate in the signal handler */
+        pEvdev->emulateWheel.kinetic_timer = TimerSet(NULL, 0, 0, NULL, NULL);
+        pEvdev->emulateWheel.kinetic_vals = valuator_mask_new(MAX_VALUATORS);
+        xf86IDrvMsg(pInfo, X_CONFIG, "EmulateWheelKineticFriction: %d\n",
+                    friction);
+    }
+
     xf86IDrvMsg(pInfo, X_CONFIG,
                 "EmulateWheelButton: %d, "
                 "EmulateWheelInertia: %d, "
@@ -324,92 +632,116 @@ EvdevWheelEmuPreInit(InputInfoPtr pInfo)
                 pEvdev->emulateWheel.button, inertia, timeout);
 }
 
+void
+EvdevWheelEmuFinalize(InputInfoPtr pInfo)
+{
+    EvdevPtr pEvdev = (EvdevPtr)pInfo->private;
+
+    EvdevWheelEmuKineticStop(pInfo);
+    TimerFree(pEvdev->emulateWheel.kinetic_timer);
+    pEvdev->emulateWheel.kinetic_timer = NULL;
+}
+
+void
+EvdevWheelEmuFree(InputInfoPtr pInfo)
+{
+    EvdevPtr pEvdev = (EvdevPtr)pInfo->private;
+
+    free(pEvdev->emulateWheel.X.samples);
+    pEvdev->emulateWheel.X.samples = NULL;
+    pEvdev->emulateWheel.Y.samples = NULL;
+}
+
 static int
-EvdevWheelEmuSetProperty(DeviceIntPtr dev, Atom atom, XIPropertyValuePtr val,
-                         BOOL checkonly)
+EvdevWheelEmuSetEnabled(DeviceIntPtr dev, XIPropertyValuePtr val, BOOL checkonly)
 {
     InputInfoPtr pInfo  = dev->public.devicePrivate;
     EvdevPtr     pEvdev = pInfo->private;
 
-    if (atom == prop_wheel_emu)
+    if (!checkonly)
     {
-        if (val->format != 8 || val->size != 1 || val->type != XA_INTEGER)
-            return BadMatch;
-
-        if (!checkonly)
+        pEvdev->emulateWheel.enabled = *((BOOL*)val->data);
+        /* Don't enable with zero inertia, otherwise we may get stuck in an
+         * infinite loop */
+        if (pEvdev->emulateWheel.inertia <= 0)
         {
-            pEvdev->emulateWheel.enabled = *((BOOL*)val->data);
-            /* Don't enable with zero inertia, otherwise we may get stuck in an
-             * infinite loop */
-            if (pEvdev->emulateWheel.inertia <= 0)
-            {
-                pEvdev->emulateWheel.inertia = 10;
-                /* We may get here before the property is actually enabled */
-                if (prop_wheel_inertia)
-                    XIChangeDeviceProperty(dev, prop_wheel_inertia, XA_INTEGER,
-                            16, PropModeReplace, 1,
-                            &pEvdev->emulateWheel.inertia, TRUE);
-            }
+            pEvdev->emulateWheel.inertia = 10;
+            /* We may get here before the property is actually enabled */
+            if (prop_wheel_inertia)
+                XIChangeDeviceProperty(dev, prop_wheel_inertia, XA_INTEGER,
+                        16, PropModeReplace, 1,
+                        &pEvdev->emulateWheel.inertia, TRUE);
         }
     }
-    else if (atom == prop_wheel_button)
-    {
-        int bt;
 
-        if (val->format != 8 || val->size != 1 || val->type != XA_INTEGER)
-            return BadMatch;
+    return Success;
+}
 
-        bt = *((CARD8*)val->data);
+static int
+EvdevWheelEmuSetButton(DeviceIntPtr dev, XIPropertyValuePtr val, BOOL checkonly)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
 
-        if (bt < 0 || bt >= EVDEV_MAXBUTTONS)
-            return BadValue;
+    if (!checkonly)
+        pEvdev->emulateWheel.button = *((CARD8*)val->data);
 
-        if (!checkonly)
-            pEvdev->emulateWheel.button = bt;
-    } else if (atom == prop_wheel_axismap)
-    {
-        if (val->format != 8 || val->size != 4 || val->type != XA_INTEGER)
-            return BadMatch;
+    return Success;
+}
 
-        if (!checkonly)
-        {
-            pEvdev->emulateWheel.X.up_button = *((CARD8*)val->data);
-            pEvdev->emulateWheel.X.down_button = *(((CARD8*)val->data) + 1);
-            pEvdev->emulateWheel.Y.up_button = *(((CARD8*)val->data) + 2);
-            pEvdev->emulateWheel.Y.down_button = *(((CARD8*)val->data) + 3);
-        }
-    } else if (atom == prop_wheel_inertia)
-    {
-        int inertia;
+static int
+EvdevWheelEmuSetAxes(DeviceIntPtr dev, XIPropertyValuePtr val, BOOL checkonly)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
 
-        if (val->format != 16 || val->size != 1 || val->type != XA_INTEGER)
-            return BadMatch;
+    if (!checkonly)
+    {
+        pEvdev->emulateWheel.X.up_button = *((CARD8*)val->data);
+        pEvdev->emulateWheel.X.down_button = *(((CARD8*)val->data) + 1);
+        pEvdev->emulateWheel.Y.up_button = *(((CARD8*)val->data) + 2);
+        pEvdev->emulateWheel.Y.down_button = *(((CARD8*)val->data) + 3);
+    }
 
-        inertia = *((CARD16*)val->data);
+    return Success;
+}
 
-        if (inertia <= 0)
-            return BadValue;
+static int
+EvdevWheelEmuSetInertia(DeviceIntPtr dev, XIPropertyValuePtr val, BOOL checkonly)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
 
-        if (!checkonly)
-            pEvdev->emulateWheel.inertia = inertia;
-    } else if (atom == prop_wheel_timeout)
-    {
-        int timeout;
+    if (!checkonly)
+        pEvdev->emulateWheel.inertia = *((CARD16*)val->data);
 
-        if (val->format != 16 || val->size != 1 || val->type != XA_INTEGER)
-            return BadMatch;
+    return Success;
+}
 
-        timeout = *((CARD16*)val->data);
+static int
+EvdevWheelEmuSetTimeout(DeviceIntPtr dev, XIPropertyValuePtr val, BOOL checkonly)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
 
-        if (timeout < 0)
-            return BadValue;
+    if (!checkonly)
+        pEvdev->emulateWheel.timeout = *((CARD16*)val->data);
 
-        if (!checkonly)
-            pEvdev->emulateWheel.timeout = timeout;
-    }
     return Success;
 }
 
+/* type, format, min/max size, min/max value, set, get */
+static const EvdevPropDesc wheel_emu_desc =
+    { XA_INTEGER, 8, 1, 1, 0, 0, EvdevWheelEmuSetEnabled, NULL };
+static const EvdevPropDesc wheel_button_desc =
+    { XA_INTEGER, 8, 1, 1, 0, EVDEV_MAXBUTTONS - 1, EvdevWheelEmuSetButton, NULL };
+static const EvdevPropDesc wheel_axismap_desc =
+    { XA_INTEGER, 8, 4, 4, 0, 0, EvdevWheelEmuSetAxes, NULL };
+static const EvdevPropDesc wheel_inertia_desc =
+    { XA_INTEGER, 16, 1, 1, 1, 0xffff, EvdevWheelEmuSetInertia, NULL };
+static const EvdevPropDesc wheel_timeout_desc =
+    { XA_INTEGER, 16, 1, 1, 0, 0, EvdevWheelEmuSetTimeout, NULL };
+
 void
 EvdevWheelEmuInitProperty(DeviceIntPtr dev)
 {
@@ -421,7 +753,8 @@ EvdevWheelEmuInitProperty(DeviceIntPtr dev)
     if (!dev->button) /* don't init prop for keyboards */
         return;
 
-    prop_wheel_emu = MakeAtom(EVDEV_PROP_WHEEL, strlen(EVDEV_PROP_WHEEL), TRUE);
+    EvdevInternAtom(&prop_wheel_emu, EVDEV_PROP_WHEEL);
+    EvdevRegisterProperty(dev, prop_wheel_emu, &wheel_emu_desc);
     rc = XIChangeDeviceProperty(dev, prop_wheel_emu, XA_INTEGER, 8,
                                 PropModeReplace, 1,
                                 &pEvdev->emulateWheel.enabled, FALSE);
@@ -435,7 +768,8 @@ EvdevWheelEmuInitProperty(DeviceIntPtr dev)
     vals[2] = pEvdev->emulateWheel.Y.up_button;
     vals[3] = pEvdev->emulateWheel.Y.down_button;
 
-    prop_wheel_axismap = MakeAtom(EVDEV_PROP_WHEEL_AXES, strlen(EVDEV_PROP_WHEEL_AXES), TRUE);
+    EvdevInternAtom(&prop_wheel_axismap, EVDEV_PROP_WHEEL_AXES);
+    EvdevRegisterProperty(dev, prop_wheel_axismap, &wheel_axismap_desc);
     rc = XIChangeDeviceProperty(dev, prop_wheel_axismap, XA_INTEGER, 8,
                                 PropModeReplace, 4, vals, FALSE);
 
@@ -444,7 +778,8 @@ EvdevWheelEmuInitProperty(DeviceIntPtr dev)
 
     XISetDevicePropertyDeletable(dev, prop_wheel_axismap, FALSE);
 
-    prop_wheel_inertia = MakeAtom(EVDEV_PROP_WHEEL_INERTIA, strlen(EVDEV_PROP_WHEEL_INERTIA), TRUE);
+    EvdevInternAtom(&prop_wheel_inertia, EVDEV_PROP_WHEEL_INERTIA);
+    EvdevRegisterProperty(dev, prop_wheel_inertia, &wheel_inertia_desc);
     rc = XIChangeDeviceProperty(dev, prop_wheel_inertia, XA_INTEGER, 16,
                                 PropModeReplace, 1,
                                 &pEvdev->emulateWheel.inertia, FALSE);
@@ -453,7 +788,8 @@ EvdevWheelEmuInitProperty(DeviceIntPtr dev)
 
     XISetDevicePropertyDeletable(dev, prop_wheel_inertia, FALSE);
 
-    prop_wheel_timeout = MakeAtom(EVDEV_PROP_WHEEL_TIMEOUT, strlen(EVDEV_PROP_WHEEL_TIMEOUT), TRUE);
+    EvdevInternAtom(&prop_wheel_timeout, EVDEV_PROP_WHEEL_TIMEOUT);
+    EvdevRegisterProperty(dev, prop_wheel_timeout, &wheel_timeout_desc);
     rc = XIChangeDeviceProperty(dev, prop_wheel_timeout, XA_INTEGER, 16,
                                 PropModeReplace, 1,
                                 &pEvdev->emulateWheel.timeout, FALSE);
@@ -462,7 +798,8 @@ EvdevWheelEmuInitProperty(DeviceIntPtr dev)
 
     XISetDevicePropertyDeletable(dev, prop_wheel_timeout, FALSE);
 
-    prop_wheel_button = MakeAtom(EVDEV_PROP_WHEEL_BUTTON, strlen(EVDEV_PROP_WHEEL_BUTTON), TRUE);
+    EvdevInternAtom(&prop_wheel_button, EVDEV_PROP_WHEEL_BUTTON);
+    EvdevRegisterProperty(dev, prop_wheel_button, &wheel_button_desc);
     rc = XIChangeDeviceProperty(dev, prop_wheel_button, XA_INTEGER, 8,
                                 PropModeReplace, 1,
                                 &pEvdev->emulateWheel.button, FALSE);
@@ -470,6 +807,4 @@ EvdevWheelEmuInitProperty(DeviceIntPtr dev)
         return;
 
     XISetDevicePropertyDeletable(dev, prop_wheel_button, FALSE);
-
-    XIRegisterPropertyHandler(dev, EvdevWheelEmuSetProperty, NULL, NULL);
 }
@@ -39,11 +39,15 @@
 #include <X11/extensions/XI.h>
 
 #include <linux/version.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <libudev.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include <xf86.h>
 #include <xf86Xinput.h>
@@ -54,7 +58,6 @@
 #include <X11/Xatom.h>
 #include <evdev-properties.h>
 #include <xserver-properties.h>
-#include <mtdev-plumbing.h>
 
 #ifndef XI_PROP_PRODUCT_ID
 #define XI_PROP_PRODUCT_ID "Device Product ID"
@@ -104,19 +107,26 @@ static int proximity_bits[] = {
 static int EvdevOn(DeviceIntPtr);
 static int EvdevCache(InputInfoPtr pInfo);
 static void EvdevKbdCtrl(DeviceIntPtr device, KeybdCtrl *ctrl);
+static void EvdevWriteLeds(InputInfoPtr pInfo);
 static int EvdevSwitchMode(ClientPtr client, DeviceIntPtr device, int mode);
 static BOOL EvdevGrabDevice(InputInfoPtr pInfo, int grab, int ungrab);
 static void EvdevSetCalibration(InputInfoPtr pInfo, int num_calibration, int calibration[4]);
+static void EvdevPalmPreInit(InputInfoPtr pInfo);
+static void EvdevUpdateAbsTransform(EvdevPtr pEvdev);
+static void EvdevUpdateRelTransform(EvdevPtr pEvdev);
+static BOOL EvdevUpdatePressureCurve(EvdevPtr pEvdev, const int curve[4]);
+static void EvdevFreeAuxFilter(EvdevPtr pEvdev);
 static int EvdevOpenDevice(InputInfoPtr pInfo);
 static void EvdevCloseDevice(InputInfoPtr pInfo);
 
 static void EvdevInitAxesLabels(EvdevPtr pEvdev, int mode, int natoms, Atom *atoms);
 static void EvdevInitOneAxisLabel(EvdevPtr pEvdev, int mapped_axis,
-                                  const char **labels, int label_idx, Atom *atoms);
+                                  const Atom *labels, int label_idx, Atom *atoms);
 static void EvdevInitButtonLabels(EvdevPtr pEvdev, int natoms, Atom *atoms);
 static void EvdevInitProperty(DeviceIntPtr dev);
 static int EvdevSetProperty(DeviceIntPtr dev, Atom atom,
                             XIPropertyValuePtr val, BOOL checkonly);
+static int EvdevGetProperty(DeviceIntPtr dev, Atom atom);
 static Atom prop_product_id;
 static Atom prop_invert;
 static Atom prop_calibration;
@@ -126,6 +136,13 @@ static Atom prop_btn_label;
 static Atom prop_device;
 static Atom prop_virtual;
 static Atom prop_scroll_dist;
+static Atom prop_palm;
+static Atom prop_hysteresis;
+static Atom prop_aux_filter;
+static Atom prop_pressure_curve;
+static Atom prop_palm_rejected;
+static Atom prop_latency;
+static Atom prop_reopen;
 
 static int EvdevSwitchMode(ClientPtr client, DeviceIntPtr device, int mode)
 {
@@ -196,6 +213,40 @@ EvdevGetMajorMinor(InputInfoPtr pInfo)
     return st.st_rdev;
 }
 
+#define DEVNUM_HASH_SIZE 64
+
+static inline unsigned int
+EvdevHashDevnum(dev_t devnum)
+{
+    return (major(devnum) * 31 + minor(devnum)) % DEVNUM_HASH_SIZE;
+}
+
+/* open devices by device number, for the duplicate check */
+static EvdevPtr open_devices[DEVNUM_HASH_SIZE];
+
+static void
+EvdevAddOpenDevice(EvdevPtr pEvdev)
+{
+    EvdevPtr *bucket = &open_devices[EvdevHashDevnum(pEvdev->min_maj)];
+
+    pEvdev->next_open = *bucket;
+    *bucket = pEvdev;
+}
+
+static void
+EvdevRemoveOpenDevice(EvdevPtr pEvdev)
+{
+    EvdevPtr *e = &open_devices[EvdevHashDevnum(pEvdev->min_maj)];
+
+    for (; *e; e = &(*e)->next_open) {
+        if (*e == pEvdev) {
+            *e = pEvdev->next_open;
+            pEvdev->next_open = NULL;
+            break;
+        }
+    }
+}
+
 /**
  * Return TRUE if one of the devices we know about has the same min/maj
  * number.
@@ -204,57 +255,37 @@ static BOOL
 EvdevIsDuplicate(InputInfoPtr pInfo)
 {
     EvdevPtr pEvdev = pInfo->private;
-    InputInfoPtr d;
-
-    nt_list_for_each_entry(d, xf86FirstLocalDevice(), next)
-    {
-        EvdevPtr e;
+    EvdevPtr e;
 
-        if (strcmp(d->drv->driverName, "evdev") != 0)
-            continue;
-
-        e = (EvdevPtr)d->private;
-        if (e != pEvdev &&
-            e->min_maj &&
-            e->min_maj == pEvdev->min_maj)
+    for (e = open_devices[EvdevHashDevnum(pEvdev->min_maj)]; e; e = e->next_open)
+        if (e != pEvdev && e->min_maj == pEvdev->min_maj)
             return TRUE;
-    }
 
     return FALSE;
 }
 
+/* udev context shared by all devices, see EvdevPlug */
+static struct udev *evdev_udev;
+
 static BOOL
-EvdevDeviceIsVirtual(const char* devicenode)
+EvdevDeviceIsVirtual(dev_t devnum)
 {
-    struct udev *udev = NULL;
-    struct udev_device *device = NULL;
-    struct stat st;
-    int rc = FALSE;
+    struct udev_device *device;
     const char *devpath;
+    BOOL rc = FALSE;
 
-    udev = udev_new();
-    if (!udev)
-        goto out;
-
-    if (stat(devicenode, &st) == -1)
-        goto out;
-
-    device = udev_device_new_from_devnum(udev, 'c', st.st_rdev);
+    if (!devnum || !evdev_udev)
+        return FALSE;
 
+    device = udev_device_new_from_devnum(evdev_udev, 'c', devnum);
     if (!device)
-        goto out;
-
+        return FALSE;
 
     devpath = udev_device_get_devpath(device);
-    if (!devpath)
-        goto out;
-
-    if (strstr(devpath, "LNXSYSTM"))
+    if (devpath && strstr(devpath, "LNXSYSTM"))
         rc = TRUE;
 
-out:
     udev_device_unref(device);
-    udev_unref(udev);
     return rc;
 }
 
@@ -318,16 +349,23 @@ EvdevQueueProximityEvent(InputInfoPtr pInfo, int value)
     }
 }
 
+/**
+ * Queue a touch event for the given slot. The valuators in changed are
+ * taken from the slot's current values when the event is posted, x and y
+ * are the already transformed coordinates.
+ */
 void
-EvdevQueueTouchEvent(InputInfoPtr pInfo, unsigned int touch, ValuatorMask *mask,
-                     uint16_t evtype)
+EvdevQueueTouchEvent(InputInfoPtr pInfo, unsigned int touch, uint64_t changed,
+                     int x, int y, uint16_t evtype)
 {
     EventQueuePtr pQueue;
     if ((pQueue = EvdevNextInQueue(pInfo)))
     {
         pQueue->type = EV_QUEUE_TOUCH;
         pQueue->detail.touch = touch;
-        valuator_mask_copy(pQueue->touchMask, mask);
+        pQueue->touchChanged = changed;
+        pQueue->touchX = x;
+        pQueue->touchY = y;
         pQueue->val = evtype;
     }
 }
@@ -354,80 +392,423 @@ EvdevQueueButtonClicks(InputInfoPtr pInfo, int button, int count)
     }
 }
 
+/**
+ * Fold swap, calibration and inversion of the x/y axes into one
+ * fixed-point transform per output axis. Must be called whenever one of
+ * those settings or the axis ranges change.
+ */
 static void
-EvdevSwapAbsValuators(EvdevPtr pEvdev, ValuatorMask *mask)
+EvdevUpdateAbsTransform(EvdevPtr pEvdev)
 {
     int i;
-    int swapped_isset[2] = {0, 0};
-    int swapped_values[2];
 
-    if (!pEvdev->swap_axes)
-        return;
+    for (i = 0; i <= 1; i++) {
+        const struct input_absinfo *abs, *src_abs;
+        int src = pEvdev->swap_axes ? 1 - i : i;
+        double scale = 1.0, offset = 0.0;
+        BOOL clamp = FALSE;
+
+        pEvdev->abs_transform.src[i] = src;
+        pEvdev->abs_transform.in_min[i] = INT_MIN;
+        pEvdev->abs_transform.in_max[i] = INT_MAX;
+        pEvdev->abs_transform.out_min[i] = INT_MIN;
+        pEvdev->abs_transform.out_max[i] = INT_MAX;
+
+        abs = libevdev_get_abs_info(pEvdev->dev, i);
+        src_abs = libevdev_get_abs_info(pEvdev->dev, src);
+        if (!abs || !src_abs) {
+            pEvdev->abs_transform.src[i] = i;
+            pEvdev->abs_transform.scale[i] = 1 << ABS_TRANSFORM_SHIFT;
+            pEvdev->abs_transform.offset[i] = 0;
+            continue;
+        }
+
+        /* scale the other axis' range onto ours */
+        if (pEvdev->swap_axes) {
+            int from_width = src_abs->maximum - src_abs->minimum;
+
+            scale = from_width ?
+                (double)(abs->maximum - abs->minimum) / from_width : 0.0;
+            offset = abs->minimum - src_abs->minimum * scale;
+            pEvdev->abs_transform.in_min[i] = src_abs->minimum;
+            pEvdev->abs_transform.in_max[i] = src_abs->maximum;
+            clamp = TRUE;
+        }
+
+        /* scale the calibrated range onto the axis range */
+        if (pEvdev->flags & EVDEV_CALIBRATED) {
+            int calib_min = i ? pEvdev->calibration.min_y : pEvdev->calibration.min_x;
+            int calib_max = i ? pEvdev->calibration.max_y : pEvdev->calibration.max_x;
+            double s = (calib_max - calib_min) ?
+                (double)(abs->maximum - abs->minimum) / (calib_max - calib_min) : 0.0;
+
+            scale *= s;
+            offset = offset * s + abs->minimum - calib_min * s;
+            clamp = TRUE;
+        }
 
-    for(i = 0; i <= 1; i++) {
-        if (valuator_mask_isset(mask, i)) {
-            const struct input_absinfo *abs1 =
-                libevdev_get_abs_info(pEvdev->dev, i);
-            const struct input_absinfo *abs2 =
-                libevdev_get_abs_info(pEvdev->dev, 1 - i);
+        if ((i == 0 && pEvdev->invert_x) || (i == 1 && pEvdev->invert_y)) {
+            scale = -scale;
+            offset = abs->maximum + abs->minimum - offset;
+        }
 
-            swapped_isset[1 - i] = 1;
-            swapped_values[1 - i] =
-                xf86ScaleAxis(valuator_mask_get(mask, i),
-                              abs2->maximum, abs2->minimum,
-                              abs1->maximum, abs1->minimum);
+        if (clamp) {
+            pEvdev->abs_transform.out_min[i] = abs->minimum;
+            pEvdev->abs_transform.out_max[i] = abs->maximum;
         }
+
+        scale *= 1 << ABS_TRANSFORM_SHIFT;
+        offset *= 1 << ABS_TRANSFORM_SHIFT;
+        pEvdev->abs_transform.scale[i] = (int64_t)(scale + (scale < 0 ? -0.5 : 0.5));
+        pEvdev->abs_transform.offset[i] = (int64_t)(offset + (offset < 0 ? -0.5 : 0.5));
+    }
+}
+
+/**
+ * Apply the transform computed by EvdevUpdateAbsTransform to count x/y
+ * pairs. The loop is free of branches and only touches local copies of
+ * the coefficients, so the compiler can vectorize it.
+ */
+static void
+EvdevTransformAbsCoords(EvdevPtr pEvdev, const int *in_x, const int *in_y,
+                        int *out_x, int *out_y, int count)
+{
+    const int *src_x = pEvdev->abs_transform.src[0] ? in_y : in_x;
+    const int *src_y = pEvdev->abs_transform.src[1] ? in_y : in_x;
+    const int64_t scale_x = pEvdev->abs_transform.scale[0],
+                  scale_y = pEvdev->abs_transform.scale[1],
+                  offset_x = pEvdev->abs_transform.offset[0] +
+                             (1 << (ABS_TRANSFORM_SHIFT - 1)),
+                  offset_y = pEvdev->abs_transform.offset[1] +
+                             (1 << (ABS_TRANSFORM_SHIFT - 1));
+    const int in_min_x = pEvdev->abs_transform.in_min[0],
+              in_max_x = pEvdev->abs_transform.in_max[0],
+              in_min_y = pEvdev->abs_transform.in_min[1],
+              in_max_y = pEvdev->abs_transform.in_max[1],
+              out_min_x = pEvdev->abs_transform.out_min[0],
+              out_max_x = pEvdev->abs_transform.out_max[0],
+              out_min_y = pEvdev->abs_transform.out_min[1],
+              out_max_y = pEvdev->abs_transform.out_max[1];
+    int i;
+
+    for (i = 0; i < count; i++) {
+        int64_t x = min(max(src_x[i], in_min_x), in_max_x);
+        int64_t y = min(max(src_y[i], in_min_y), in_max_y);
+
+        x = (x * scale_x + offset_x) >> ABS_TRANSFORM_SHIFT;
+        y = (y * scale_y + offset_y) >> ABS_TRANSFORM_SHIFT;
+
+        out_x[i] = min(max(x, out_min_x), out_max_x);
+        out_y[i] = min(max(y, out_min_y), out_max_y);
+    }
+}
+
+/**
+ * Apply the transform computed by EvdevUpdateAbsTransform to the x/y
+ * valuators in mask.
+ */
+static void
+EvdevApplyAbsTransform(EvdevPtr pEvdev, ValuatorMask *mask)
+{
+    int i;
+    int isset[2], in[2], out[2];
+
+    for (i = 0; i <= 1; i++) {
+        isset[i] = valuator_mask_isset(mask, i);
+        in[i] = isset[i] ? valuator_mask_get(mask, i) : 0;
     }
 
+    EvdevTransformAbsCoords(pEvdev, &in[0], &in[1], &out[0], &out[1], 1);
+
     for (i = 0; i <= 1; i++) {
-        if (swapped_isset[i])
-            valuator_mask_set(mask, i, swapped_values[i]);
+        if (isset[pEvdev->abs_transform.src[i]])
+            valuator_mask_set(mask, i, out[i]);
         else
             valuator_mask_unset(mask, i);
     }
 }
 
+/**
+ * Drop x/y changes that stay within the hysteresis threshold of the last
+ * position passed on, so a resting finger or pen doesn't generate events.
+ *
+ * @return FALSE if no valuators are left in mask
+ */
+static BOOL
+EvdevApplyHysteresis(EvdevPtr pEvdev, ValuatorMask *mask)
+{
+    int i, val;
+
+    for (i = 0; i <= 1; i++) {
+        if (pEvdev->hysteresis.threshold[i] == 0 ||
+            !valuator_mask_fetch(mask, i, &val))
+            continue;
+
+        if (pEvdev->hysteresis.valid[i] &&
+            abs(val - pEvdev->hysteresis.center[i]) <= pEvdev->hysteresis.threshold[i])
+            valuator_mask_unset(mask, i);
+        else {
+            pEvdev->hysteresis.center[i] = val;
+            pEvdev->hysteresis.valid[i] = TRUE;
+        }
+    }
+
+    return valuator_mask_num_valuators(mask) > 0;
+}
+
+/* largest pressure range that gets a lookup table */
+#define PRESSURE_LUT_MAX 65536
+
+/* a cubic Bézier from (0, 0) to (1, 1) with control points p1, p2 */
+static inline double
+EvdevBezier(double t, double p1, double p2)
+{
+    double u = 1.0 - t;
+
+    return 3 * u * u * t * p1 + 3 * u * t * t * p2 + t * t * t;
+}
+
+/**
+ * Fill lut with the pressure curve for the range min..max. The curve's
+ * control points are in percent, x(t) is monotonic for control points in
+ * 0..100 so each entry is found by bisection on t.
+ */
 static void
-EvdevApplyCalibration(EvdevPtr pEvdev, ValuatorMask *mask)
+EvdevFillPressureLUT(const int curve[4], int min, int max, int32_t *lut)
+{
+    double x1 = curve[0] / 100.0, y1 = curve[1] / 100.0;
+    double x2 = curve[2] / 100.0, y2 = curve[3] / 100.0;
+    int range = max - min;
+    int i, j;
+
+    for (i = 0; i <= range; i++) {
+        double x = (double)i / range;
+        double lo = 0.0, hi = 1.0, t;
+
+        for (j = 0; j < 24; j++) {
+            t = (lo + hi) / 2;
+            if (EvdevBezier(t, x1, x2) < x)
+                lo = t;
+            else
+                hi = t;
+        }
+
+        lut[i] = min + (int)(EvdevBezier((lo + hi) / 2, y1, y2) * range + 0.5);
+    }
+}
+
+/**
+ * Rebuild the pressure lookup tables for a new curve. A linear curve
+ * needs no tables, pressure is then passed on unchanged.
+ *
+ * @return FALSE if a table couldn't be allocated, the old curve is kept
+ */
+static BOOL
+EvdevUpdatePressureCurve(EvdevPtr pEvdev, const int curve[4])
 {
+    static const int codes[2] = { ABS_PRESSURE, ABS_MT_PRESSURE };
+    BOOL linear = curve[0] == curve[1] && curve[2] == curve[3];
+    int32_t *lut[2] = { NULL, NULL };
+    int min[2] = { 0, 0 }, max[2] = { 0, 0 };
     int i;
+#if !HAVE_THREADED_INPUT
+    int sigstate;
+#endif
 
-    for (i = 0; i <= 1; i++) {
-        const struct input_absinfo *abs;
-        int val;
-        int calib_min;
-        int calib_max;
+    for (i = 0; i < 2 && !linear; i++) {
+        const struct input_absinfo *absinfo;
 
-        if (!valuator_mask_isset(mask, i))
+        if (pEvdev->abs_axis_map[codes[i]] < 0)
             continue;
 
-        val = valuator_mask_get(mask, i);
-        abs = libevdev_get_abs_info(pEvdev->dev, i);
+        absinfo = libevdev_get_abs_info(pEvdev->dev, codes[i]);
+        if (!absinfo || absinfo->maximum <= absinfo->minimum ||
+            absinfo->maximum - absinfo->minimum >= PRESSURE_LUT_MAX)
+            continue;
 
-        if (i == 0) {
-            calib_min = pEvdev->calibration.min_x;
-            calib_max = pEvdev->calibration.max_x;
-        } else {
-            calib_min = pEvdev->calibration.min_y;
-            calib_max = pEvdev->calibration.max_y;
+        min[i] = absinfo->minimum;
+        max[i] = absinfo->maximum;
+        lut[i] = malloc((max[i] - min[i] + 1) * sizeof(int32_t));
+        if (!lut[i]) {
+            free(lut[0]);
+            return FALSE;
         }
+        EvdevFillPressureLUT(curve, min[i], max[i], lut[i]);
+    }
+
+#if HAVE_THREADED_INPUT
+    input_lock();
+#else
+    sigstate = xf86BlockSIGIO();
+#endif
+
+    for (i = 0; i < 2; i++) {
+        free(pEvdev->pressure.lut[i]);
+        pEvdev->pressure.lut[i] = lut[i];
+        pEvdev->pressure.min[i] = min[i];
+        pEvdev->pressure.max[i] = max[i];
+    }
+    memcpy(pEvdev->pressure.curve, curve, sizeof(pEvdev->pressure.curve));
+
+#if HAVE_THREADED_INPUT
+    input_unlock();
+#else
+    xf86UnblockSIGIO(sigstate);
+#endif
+
+    return TRUE;
+}
 
-        if (pEvdev->flags & EVDEV_CALIBRATED)
-            val = xf86ScaleAxis(val, abs->maximum, abs->minimum,
-                                calib_max, calib_min);
+/**
+ * Map a pressure value through the curve, which = 0 for ABS_PRESSURE and
+ * 1 for ABS_MT_PRESSURE.
+ */
+static inline int
+EvdevMapPressure(EvdevPtr pEvdev, int which, int value)
+{
+    const int32_t *lut = pEvdev->pressure.lut[which];
+
+    if (!lut)
+        return value;
+
+    if (value < pEvdev->pressure.min[which])
+        value = pEvdev->pressure.min[which];
+    else if (value > pEvdev->pressure.max[which])
+        value = pEvdev->pressure.max[which];
+
+    return lut[value - pEvdev->pressure.min[which]];
+}
+
+/**
+ * Precompute the relative x/y transform from swap_axes, invert_x/y and the
+ * resolution. Called whenever one of them changes.
+ */
+static void
+EvdevUpdateRelTransform(EvdevPtr pEvdev)
+{
+    double scale = 1.0;
+    int i;
+
+    if (pEvdev->resolution > 0)
+        scale = DEFAULT_MOUSE_DPI / pEvdev->resolution;
+
+    pEvdev->rel_transform.src[0] = pEvdev->swap_axes ? 1 : 0;
+    pEvdev->rel_transform.src[1] = pEvdev->swap_axes ? 0 : 1;
+    pEvdev->rel_transform.scale[0] = pEvdev->invert_x ? -scale : scale;
+    pEvdev->rel_transform.scale[1] = pEvdev->invert_y ? -scale : scale;
+
+    for (i = 0; i < 2; i++)
+        pEvdev->rel_transform.remainder[i] = 0;
+}
+
+/**
+ * Transform the relative x/y motion in rel_vals. Only whole device units
+ * are posted, the fraction left over after scaling is carried into the
+ * next event in the same direction, so slow motion on high resolution
+ * devices isn't lost.
+ */
+static void
+EvdevApplyRelTransform(InputInfoPtr pInfo)
+{
+    EvdevPtr pEvdev = pInfo->private;
+    double in[2] = { 0, 0 }, out[2];
+    int i;
+
+    if (valuator_mask_isset(pEvdev->rel_vals, REL_X))
+        in[0] = valuator_mask_get_double(pEvdev->rel_vals, REL_X);
+    if (valuator_mask_isset(pEvdev->rel_vals, REL_Y))
+        in[1] = valuator_mask_get_double(pEvdev->rel_vals, REL_Y);
+
+    for (i = 0; i < 2; i++) {
+        double delta = in[pEvdev->rel_transform.src[i]] *
+                       pEvdev->rel_transform.scale[i];
+
+        out[i] = 0;
+        if (delta == 0)
+            continue;
+
+        /* drop the remainder when the direction changes */
+        if (delta * pEvdev->rel_transform.remainder[i] < 0)
+            pEvdev->rel_transform.remainder[i] = 0;
+
+        delta += pEvdev->rel_transform.remainder[i];
+        out[i] = (int)delta;
+        pEvdev->rel_transform.remainder[i] = delta - out[i];
+    }
+
+    if (out[0])
+        valuator_mask_set_double(pEvdev->rel_vals, REL_X, out[0]);
+    else
+        valuator_mask_unset(pEvdev->rel_vals, REL_X);
+
+    if (out[1])
+        valuator_mask_set_double(pEvdev->rel_vals, REL_Y, out[1]);
+    else
+        valuator_mask_unset(pEvdev->rel_vals, REL_Y);
+
+    Evdev3BEmuProcessRelMotion(pInfo, out[0], out[1]);
+}
+
+/**
+ * Extrapolate the x/y position in abs_vals. An axis that didn't change in
+ * this frame, or whose change hysteresis dropped, is fed to the predictor
+ * with its last value but not posted.
+ */
+static void
+EvdevPredictPointer(EvdevPtr pEvdev, CARD32 time)
+{
+    PredictorPtr p = &pEvdev->predict.pointer;
+    BOOL set[2];
+    int pos[2];
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        set[i] = valuator_mask_fetch(pEvdev->abs_vals, i, &pos[i]);
+        if (set[i])
+            continue;
+        if (p->samples)
+            pos[i] = p->measured[i];
+        else if (!valuator_mask_fetch(pEvdev->old_vals, i, &pos[i]))
+            return;
+    }
+
+    if (!set[0] && !set[1])
+        return;
 
-        if ((i == 0 && pEvdev->invert_x) || (i == 1 && pEvdev->invert_y))
-            val = (abs->maximum - val + abs->minimum);
+    if (EvdevPredict(pEvdev, p, time, pos)) {
+        for (i = 0; i < 2; i++)
+            if (set[i])
+                valuator_mask_set(pEvdev->abs_vals, i, pos[i]);
+        pEvdev->predict.extrapolated = TRUE;
+    }
+}
 
-        valuator_mask_set(mask, i, val);
+/**
+ * Post the measured position of the pointer if the last one posted was
+ * extrapolated, and restart its predictor.
+ */
+static void
+EvdevPredictSettlePointer(InputInfoPtr pInfo)
+{
+    EvdevPtr pEvdev = pInfo->private;
+    PredictorPtr p = &pEvdev->predict.pointer;
+
+    if (p->extrapolated && pEvdev->predict.mask && pEvdev->in_proximity) {
+        valuator_mask_zero(pEvdev->predict.mask);
+        valuator_mask_set(pEvdev->predict.mask, 0, p->measured[0]);
+        valuator_mask_set(pEvdev->predict.mask, 1, p->measured[1]);
+        EvdevApplyAbsTransform(pEvdev, pEvdev->predict.mask);
+        xf86PostMotionEventM(pInfo->dev, Absolute, pEvdev->predict.mask);
     }
+
+    EvdevPredictReset(p);
 }
 
 /**
  * Take the valuators and process them accordingly.
  */
 static void
-EvdevProcessValuators(InputInfoPtr pInfo)
+EvdevProcessValuators(InputInfoPtr pInfo, CARD32 time)
 {
     EvdevPtr pEvdev = pInfo->private;
     int val;
@@ -441,41 +822,7 @@ EvdevProcessValuators(InputInfoPtr pInfo)
 
     /* Apply transformations on relative coordinates */
     if (pEvdev->rel_queued) {
-        double deltaX = 0, deltaY = 0;
-
-        if (valuator_mask_isset(pEvdev->rel_vals, REL_X))
-            deltaX = valuator_mask_get_double(pEvdev->rel_vals, REL_X);
-        if (valuator_mask_isset(pEvdev->rel_vals, REL_Y))
-            deltaY = valuator_mask_get_double(pEvdev->rel_vals, REL_Y);
-
-        if (pEvdev->swap_axes) {
-            double tmp = deltaX;
-            deltaX = deltaY;
-            deltaY = tmp;
-        }
-
-        if (pEvdev->resolution > 0) {
-            deltaX *= DEFAULT_MOUSE_DPI / pEvdev->resolution;
-            deltaY *= DEFAULT_MOUSE_DPI / pEvdev->resolution;
-        }
-
-        if (pEvdev->invert_x)
-            deltaX *= -1;
-        if (pEvdev->invert_y)
-            deltaY *= -1;
-
-        if (deltaX)
-            valuator_mask_set_double(pEvdev->rel_vals, REL_X, deltaX);
-        else
-            valuator_mask_unset(pEvdev->rel_vals, REL_X);
-
-        if (deltaY)
-            valuator_mask_set_double(pEvdev->rel_vals, REL_Y, deltaY);
-        else
-            valuator_mask_unset(pEvdev->rel_vals, REL_Y);
-
-        Evdev3BEmuProcessRelMotion(pInfo, deltaX, deltaY);
-
+        EvdevApplyRelTransform(pInfo);
     }
     /*
      * Some devices only generate valid abs coords when BTN_TOOL_PEN is
@@ -487,8 +834,13 @@ EvdevProcessValuators(InputInfoPtr pInfo)
      * just works.
      */
     else if (pEvdev->abs_queued && pEvdev->in_proximity) {
-        EvdevSwapAbsValuators(pEvdev, pEvdev->abs_vals);
-        EvdevApplyCalibration(pEvdev, pEvdev->abs_vals);
+        if (!EvdevApplyHysteresis(pEvdev, pEvdev->abs_vals)) {
+            pEvdev->abs_queued = 0;
+            return;
+        }
+        if (pEvdev->predict.time)
+            EvdevPredictPointer(pEvdev, time);
+        EvdevApplyAbsTransform(pEvdev, pEvdev->abs_vals);
         Evdev3BEmuProcessAbsMotion(pInfo, pEvdev->abs_vals);
     }
 }
@@ -615,67 +967,118 @@ EvdevProcessRelativeMotionEvent(InputInfoPtr pInfo, struct input_event *ev)
     value = ev->value;
 
     switch (ev->code) {
+        /* High-resolution wheels send both events, only use the
+         * high-resolution one. It is posted on the wheel's valuator */
+        case REL_WHEEL:
+            if (pEvdev->smoothScroll.vert_units > 1)
+                return;
+            map = pEvdev->rel_axis_map[REL_WHEEL];
+            break;
+        case REL_HWHEEL:
+            if (pEvdev->smoothScroll.horiz_units > 1)
+                return;
+            map = pEvdev->rel_axis_map[REL_HWHEEL];
+            break;
+        case REL_WHEEL_HI_RES:
+            if (pEvdev->smoothScroll.vert_units == 1)
+                return;
+            map = pEvdev->rel_axis_map[REL_WHEEL];
+            break;
+        case REL_HWHEEL_HI_RES:
+            if (pEvdev->smoothScroll.horiz_units == 1)
+                return;
+            map = pEvdev->rel_axis_map[REL_HWHEEL];
+            break;
+        case REL_DIAL:
+            map = pEvdev->rel_axis_map[REL_DIAL];
+            break;
         default:
             /* Ignore EV_REL events if we never set up for them. */
-            if (!(pEvdev->flags & EVDEV_RELATIVE_EVENTS) &&
-                    ev->code != REL_WHEEL && ev->code != REL_DIAL &&
-                    ev->code != REL_HWHEEL)
-                return;
-
-            /* Handle mouse wheel emulation */
-            if (EvdevWheelEmuFilterMotion(pInfo, ev))
+            if (!(pEvdev->flags & EVDEV_RELATIVE_EVENTS))
                 return;
-
-            pEvdev->rel_queued = 1;
             map = pEvdev->rel_axis_map[ev->code];
-
-            if (valuator_mask_isset(pEvdev->rel_vals, map))
-                value += valuator_mask_get(pEvdev->rel_vals, map);
-
-            valuator_mask_set(pEvdev->rel_vals, map, value);
             break;
     }
-}
-
-static void
-EvdevProcessTouch(InputInfoPtr pInfo)
-{
-    EvdevPtr pEvdev = pInfo->private;
-    int type;
-    int slot = pEvdev->cur_slot;
 
-    if (slot < 0 || !pEvdev->mt_mask)
+    if (map == -1)
         return;
 
-    if (!pEvdev->slots[slot].dirty)
+    /* Handle mouse wheel emulation */
+    if (EvdevWheelEmuFilterMotion(pInfo, ev))
         return;
 
-    switch(pEvdev->slots[slot].state)
-    {
-        case SLOTSTATE_EMPTY:
-            return;
-        case SLOTSTATE_CLOSE:
-            type = XI_TouchEnd;
-            pEvdev->slots[slot].state = SLOTSTATE_EMPTY;
-            break;
-        case SLOTSTATE_OPEN:
-            type = XI_TouchBegin;
-            pEvdev->slots[slot].state = SLOTSTATE_UPDATE;
-            break;
-        case SLOTSTATE_UPDATE:
-        default:
-            type = XI_TouchUpdate;
-            break;
-    }
+    pEvdev->rel_queued = 1;
 
-    EvdevSwapAbsValuators(pEvdev, pEvdev->mt_mask);
-    EvdevApplyCalibration(pEvdev, pEvdev->mt_mask);
+    if (valuator_mask_isset(pEvdev->rel_vals, map))
+        value += valuator_mask_get(pEvdev->rel_vals, map);
 
-    EvdevQueueTouchEvent(pInfo, pEvdev->cur_slot, pEvdev->mt_mask, type);
+    valuator_mask_set(pEvdev->rel_vals, map, value);
+}
 
-    pEvdev->slots[slot].dirty = 0;
+static inline int32_t *
+EvdevSlotVals(EvdevPtr pEvdev, int slot)
+{
+    return &pEvdev->slot_vals[slot * MAX_VALUATORS];
+}
 
-    valuator_mask_zero(pEvdev->mt_mask);
+/**
+ * Allocate all per-slot multitouch state as one block: the changed and
+ * set valuator masks, the predictors, the current valuator values, the
+ * dirty bitmap, the raw pressures, the frame buffer and the slot states.
+ */
+static BOOL
+EvdevAllocSlots(EvdevPtr pEvdev, int nslots)
+{
+    size_t masks = 2 * nslots * sizeof(uint64_t),
+           predict = nslots * sizeof(PredictorRec),
+           vals = nslots * MAX_VALUATORS * sizeof(int32_t),
+           dirty = NLONGS(nslots) * sizeof(unsigned long),
+           pressure = nslots * sizeof(int32_t),
+           frame = 5 * nslots * sizeof(int);
+    char *slab;
+
+    slab = calloc(1, masks + predict + vals + dirty + pressure + frame + nslots);
+    if (!slab)
+        return FALSE;
+
+    pEvdev->mt_slab = slab;
+    pEvdev->mt_slab_size = masks + predict + vals + dirty + pressure + frame +
+                           nslots;
+    pEvdev->nslots = nslots;
+    pEvdev->slot_changed = (uint64_t*)slab;
+    pEvdev->slot_vals_set = pEvdev->slot_changed + nslots;
+    pEvdev->slot_predict = (PredictorRec*)(slab + masks);
+    pEvdev->slot_vals = (int32_t*)(slab + masks + predict);
+    pEvdev->dirty_slots = (unsigned long*)(slab + masks + predict + vals);
+    pEvdev->slot_pressure = (int32_t*)(slab + masks + predict + vals + dirty);
+    pEvdev->mt_frame.slot = (int*)(slab + masks + predict + vals + dirty +
+                                   pressure);
+    pEvdev->mt_frame.x = pEvdev->mt_frame.slot + nslots;
+    pEvdev->mt_frame.y = pEvdev->mt_frame.x + nslots;
+    pEvdev->mt_frame.tx = pEvdev->mt_frame.y + nslots;
+    pEvdev->mt_frame.ty = pEvdev->mt_frame.tx + nslots;
+    pEvdev->slot_state = (uint8_t*)(slab + masks + predict + vals + dirty +
+                                    pressure + frame);
+    memset(pEvdev->slot_state, SLOTSTATE_EMPTY, nslots);
+    pEvdev->palm.active = 0;
+
+    return TRUE;
+}
+
+/**
+ * Forget all touches, their ends are lost while the device is off or
+ * its events are discarded. A contact still down is ignored until it
+ * lifts, a new one starts normally.
+ */
+static void
+EvdevResetSlots(EvdevPtr pEvdev)
+{
+    if (!pEvdev->mt_slab)
+        return;
+
+    memset(pEvdev->slot_state, SLOTSTATE_EMPTY, pEvdev->nslots);
+    memset(pEvdev->dirty_slots, 0, NLONGS(pEvdev->nslots) * sizeof(unsigned long));
+    pEvdev->palm.active = 0;
 }
 
 static int
@@ -683,8 +1086,8 @@ num_slots(EvdevPtr pEvdev)
 {
     int value;
 
-    if (pEvdev->mtdev)
-        value = pEvdev->mtdev->caps.slot.maximum + 1;
+    if (pEvdev->mtrack)
+        value = EVDEV_MTRACK_MAX_CONTACTS;
     else
         value = libevdev_get_num_slots(pEvdev->dev);
 
@@ -692,13 +1095,170 @@ num_slots(EvdevPtr pEvdev)
     return value > 1 ? value : 10;
 }
 
-static int
-last_mt_vals_slot(EvdevPtr pEvdev)
+/**
+ * Check a touch against the palm rejection thresholds. The pressure is
+ * compared before the pressure curve, begins is the number of touches
+ * already accepted to begin in this frame.
+ *
+ * @return TRUE if the touch must be dropped
+ */
+static BOOL
+EvdevPalmReject(EvdevPtr pEvdev, int slot, int begins)
 {
-    int value = pEvdev->cur_slot;
+    const int32_t *vals = EvdevSlotVals(pEvdev, slot);
+    uint64_t set = pEvdev->slot_vals_set[slot];
+    int map;
 
-    return value < num_slots(pEvdev) ? value : -1;
-}
+    map = pEvdev->abs_axis_map[ABS_MT_TOUCH_MAJOR];
+    if (pEvdev->palm.touch_major > 0 && map >= 0 && (set & (1ULL << map)) &&
+        vals[map] > pEvdev->palm.touch_major) {
+        pEvdev->palm.rejected[0]++;
+        return TRUE;
+    }
+
+    map = pEvdev->abs_axis_map[ABS_MT_PRESSURE];
+    if (pEvdev->palm.pressure > 0 && map >= 0 && (set & (1ULL << map)) &&
+        pEvdev->slot_pressure[slot] > pEvdev->palm.pressure) {
+        pEvdev->palm.rejected[1]++;
+        return TRUE;
+    }
+
+    if (pEvdev->slot_state[slot] == SLOTSTATE_OPEN &&
+        pEvdev->palm.max_touches > 0 &&
+        pEvdev->palm.active + begins >= pEvdev->palm.max_touches) {
+        pEvdev->palm.rejected[2]++;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/**
+ * Extrapolate the position of a touch in the frame buffer. Touches are
+ * predicted from their third update on, the begin and end of a touch
+ * are always posted at the measured position.
+ */
+static void
+EvdevPredictTouch(EvdevPtr pEvdev, int slot, CARD32 time, int n)
+{
+    PredictorPtr p = &pEvdev->slot_predict[slot];
+    int pos[2];
+
+    if (pEvdev->slot_state[slot] != SLOTSTATE_UPDATE ||
+        (pEvdev->slot_vals_set[slot] & 3) != 3) {
+        EvdevPredictReset(p);
+        return;
+    }
+
+    pos[0] = pEvdev->mt_frame.x[n];
+    pos[1] = pEvdev->mt_frame.y[n];
+    if (EvdevPredict(pEvdev, p, time, pos)) {
+        pEvdev->mt_frame.x[n] = pos[0];
+        pEvdev->mt_frame.y[n] = pos[1];
+        pEvdev->slot_changed[slot] |= 3;
+        pEvdev->predict.extrapolated = TRUE;
+    }
+}
+
+/**
+ * Queue touch events for all slots that changed in this frame. The x/y
+ * coordinates of all those slots are gathered into the frame buffer and
+ * transformed in one pass before the events are queued.
+ */
+static void
+EvdevProcessTouch(InputInfoPtr pInfo, CARD32 time)
+{
+    EvdevPtr pEvdev = pInfo->private;
+    int slot, i, w, n = 0, begins = 0;
+
+    if (!pEvdev->mt_mask)
+        return;
+
+    for (w = 0; w < NLONGS(pEvdev->nslots); w++) {
+        unsigned long dirty = pEvdev->dirty_slots[w];
+
+        pEvdev->dirty_slots[w] = 0;
+
+        for (; dirty; dirty &= dirty - 1) {
+            slot = w * LONG_BITS + __builtin_ctzl(dirty);
+
+            if ((pEvdev->slot_state[slot] == SLOTSTATE_OPEN ||
+                 pEvdev->slot_state[slot] == SLOTSTATE_UPDATE) &&
+                EvdevPalmReject(pEvdev, slot, begins)) {
+                /* never start a rejected touch, end a running one */
+                if (pEvdev->slot_state[slot] == SLOTSTATE_UPDATE)
+                    pEvdev->slot_state[slot] = SLOTSTATE_CLOSE;
+                else
+                    pEvdev->slot_state[slot] = SLOTSTATE_EMPTY;
+            }
+
+            if (pEvdev->slot_state[slot] == SLOTSTATE_EMPTY) {
+                pEvdev->slot_changed[slot] = 0;
+                continue;
+            }
+
+            if (pEvdev->slot_state[slot] == SLOTSTATE_OPEN)
+                begins++;
+
+            pEvdev->mt_frame.slot[n] = slot;
+            pEvdev->mt_frame.x[n] = EvdevSlotVals(pEvdev, slot)[0];
+            pEvdev->mt_frame.y[n] = EvdevSlotVals(pEvdev, slot)[1];
+            if (pEvdev->predict.time)
+                EvdevPredictTouch(pEvdev, slot, time, n);
+            n++;
+        }
+    }
+
+    if (n == 0)
+        return;
+
+    EvdevTransformAbsCoords(pEvdev, pEvdev->mt_frame.x, pEvdev->mt_frame.y,
+                            pEvdev->mt_frame.tx, pEvdev->mt_frame.ty, n);
+
+    for (i = 0; i < n; i++) {
+        uint64_t changed;
+        int type;
+
+        slot = pEvdev->mt_frame.slot[i];
+
+        switch(pEvdev->slot_state[slot])
+        {
+            case SLOTSTATE_CLOSE:
+                type = XI_TouchEnd;
+                pEvdev->slot_state[slot] = SLOTSTATE_EMPTY;
+                pEvdev->palm.active--;
+                break;
+            case SLOTSTATE_OPEN:
+                type = XI_TouchBegin;
+                pEvdev->slot_state[slot] = SLOTSTATE_UPDATE;
+                pEvdev->palm.active++;
+                break;
+            case SLOTSTATE_UPDATE:
+            default:
+                type = XI_TouchUpdate;
+                break;
+        }
+
+        /* x/y may come from the other axis if swapped */
+        changed = pEvdev->slot_changed[slot];
+        changed = (changed & ~3ULL) |
+                  (((changed >> pEvdev->abs_transform.src[0]) & 1) << 0) |
+                  (((changed >> pEvdev->abs_transform.src[1]) & 1) << 1);
+
+        EvdevQueueTouchEvent(pInfo, slot, changed, pEvdev->mt_frame.tx[i],
+                             pEvdev->mt_frame.ty[i], type);
+
+        pEvdev->slot_changed[slot] = 0;
+    }
+}
+
+static int
+last_mt_vals_slot(EvdevPtr pEvdev)
+{
+    int value = pEvdev->cur_slot;
+
+    return value < pEvdev->nslots ? value : -1;
+}
 
 static void
 EvdevProcessTouchEvent(InputInfoPtr pInfo, struct input_event *ev)
@@ -706,7 +1266,7 @@ EvdevProcessTouchEvent(InputInfoPtr pInfo, struct input_event *ev)
     EvdevPtr pEvdev = pInfo->private;
     int map;
 
-    if (!pEvdev->mtdev &&
+    if (!pEvdev->mtrack &&
         !libevdev_has_event_code(pEvdev->dev, EV_ABS, ABS_MT_SLOT))
         return;
 
@@ -714,13 +1274,12 @@ EvdevProcessTouchEvent(InputInfoPtr pInfo, struct input_event *ev)
         return;
 
     if (ev->code == ABS_MT_SLOT) {
-        EvdevProcessTouch(pInfo);
-        if (ev->value >= num_slots(pEvdev) ) {
+        if (ev->value >= pEvdev->nslots) {
             LogMessageVerbSigSafe(X_WARNING, 0,
                                   "%s: Slot index %d out of bounds (max %d), touch events may be incorrect.\n",
                                   pInfo->name,
                                   ev->value,
-                                  num_slots(pEvdev) - 1);
+                                  pEvdev->nslots - 1);
             return;
         }
         pEvdev->cur_slot = ev->value;
@@ -735,22 +1294,167 @@ EvdevProcessTouchEvent(InputInfoPtr pInfo, struct input_event *ev)
                     return;
         }
 
-        pEvdev->slots[slot_index].dirty = 1;
+        EvdevSetBit(pEvdev->dirty_slots, slot_index);
         if (ev->code == ABS_MT_TRACKING_ID) {
             if (ev->value >= 0) {
-                pEvdev->slots[slot_index].state = SLOTSTATE_OPEN;
+                pEvdev->slot_state[slot_index] = SLOTSTATE_OPEN;
 
-                valuator_mask_copy(pEvdev->mt_mask,
-                                   pEvdev->last_mt_vals[slot_index]);
-            } else if (pEvdev->slots[slot_index].state != SLOTSTATE_EMPTY)
-                pEvdev->slots[slot_index].state = SLOTSTATE_CLOSE;
+                /* a new touch starts with all last known values */
+                pEvdev->slot_changed[slot_index] |= pEvdev->slot_vals_set[slot_index];
+            } else if (pEvdev->slot_state[slot_index] != SLOTSTATE_EMPTY)
+                pEvdev->slot_state[slot_index] = SLOTSTATE_CLOSE;
         } else {
             map = pEvdev->abs_axis_map[ev->code];
-            valuator_mask_set(pEvdev->mt_mask, map, ev->value);
-            valuator_mask_set(pEvdev->last_mt_vals[slot_index], map,
-                              ev->value);
+            if (map < 0)
+                return;
+            if (ev->code == ABS_MT_PRESSURE)
+                pEvdev->slot_pressure[slot_index] = ev->value;
+            EvdevSlotVals(pEvdev, slot_index)[map] =
+                ev->code == ABS_MT_PRESSURE ?
+                EvdevMapPressure(pEvdev, 1, ev->value) : ev->value;
+            pEvdev->slot_vals_set[slot_index] |= 1ULL << map;
+            pEvdev->slot_changed[slot_index] |= 1ULL << map;
+        }
+    }
+}
+
+/**
+ * Post the values the rate limit held back, once the axis may send again.
+ * Otherwise an axis that stops moving right after a held back value would
+ * never reach its final position.
+ */
+static CARD32
+EvdevAuxTimer(OsTimerPtr timer, CARD32 time, pointer arg)
+{
+    InputInfoPtr pInfo = arg;
+    EvdevPtr pEvdev = pInfo->private;
+    int map;
+
+#if HAVE_THREADED_INPUT
+    input_lock();
+#else
+    int sigstate = xf86BlockSIGIO();
+#endif
+
+    valuator_mask_zero(pEvdev->aux.mask);
+    for (map = 2; map < MAX_VALUATORS; map++) {
+        struct aux_axis *axis = &pEvdev->aux.axes[map];
+
+        if (!axis->pending)
+            continue;
+
+        axis->last = axis->pending_value;
+        axis->time = axis->pending_time + (time - axis->pending_since);
+        axis->pending = FALSE;
+        valuator_mask_set(pEvdev->aux.mask, map, axis->last);
+    }
+
+    if (valuator_mask_num_valuators(pEvdev->aux.mask) && pEvdev->in_proximity)
+        xf86PostMotionEventM(pInfo->dev, Absolute, pEvdev->aux.mask);
+
+#if HAVE_THREADED_INPUT
+    input_unlock();
+#else
+    xf86UnblockSIGIO(sigstate);
+#endif
+
+    return 0;
+}
+
+/**
+ * Apply the deadzone, minimum change and rate limit to a value of an
+ * auxiliary (non-x/y) absolute axis. The deadzone is around the centre
+ * for axes that go negative (sticks, tilt) and above the minimum for all
+ * others (pressure, throttles, wheels). A value held back by the rate
+ * limit is posted by EvdevAuxTimer unless a newer one replaces it.
+ *
+ * @return TRUE if the value must be dropped
+ */
+static BOOL
+EvdevFilterAuxAxis(InputInfoPtr pInfo, struct input_event *ev, int map,
+                   int *value)
+{
+    EvdevPtr pEvdev = pInfo->private;
+    const struct input_absinfo *absinfo;
+    struct aux_axis *axis;
+    CARD32 time;
+    int rest;
+
+    if (!pEvdev->aux.axes ||
+        (!pEvdev->aux.deadzone && !pEvdev->aux.min_change && !pEvdev->aux.max_rate))
+        return FALSE;
+
+    axis = &pEvdev->aux.axes[map];
+
+    absinfo = libevdev_get_abs_info(pEvdev->dev, ev->code);
+    if (!absinfo)
+        return FALSE;
+
+    rest = absinfo->minimum < 0 ?
+        (absinfo->minimum + absinfo->maximum) / 2 : absinfo->minimum;
+    if (abs(*value - rest) <= pEvdev->aux.deadzone)
+        *value = rest;
+
+    time = ev->time.tv_sec * 1000 + ev->time.tv_usec / 1000;
+
+    if (axis->valid) {
+        if (*value == axis->last ||
+            abs(*value - axis->last) < pEvdev->aux.min_change) {
+            axis->pending = FALSE;
+            return TRUE;
         }
+
+        if (pEvdev->aux.max_rate &&
+            time - axis->time < 1000 / pEvdev->aux.max_rate) {
+            if (!axis->pending)
+                TimerSet(pEvdev->aux.timer, 0,
+                         1000 / pEvdev->aux.max_rate - (time - axis->time),
+                         EvdevAuxTimer, pInfo);
+            axis->pending_value = *value;
+            axis->pending_time = time;
+            axis->pending_since = GetTimeInMillis();
+            axis->pending = TRUE;
+            return TRUE;
+        }
+    }
+
+    axis->last = *value;
+    axis->time = time;
+    axis->valid = TRUE;
+    axis->pending = FALSE;
+
+    return FALSE;
+}
+
+/**
+ * Allocate the per-axis state of the auxiliary axis filter, done when one
+ * of its settings is first enabled.
+ */
+static BOOL
+EvdevAllocAuxFilter(EvdevPtr pEvdev)
+{
+    if (pEvdev->aux.axes)
+        return TRUE;
+
+    pEvdev->aux.axes = calloc(MAX_VALUATORS, sizeof(*pEvdev->aux.axes));
+    pEvdev->aux.mask = valuator_mask_new(MAX_VALUATORS);
+    pEvdev->aux.timer = TimerSet(NULL, 0, 0, NULL, NULL);
+    if (!pEvdev->aux.axes || !pEvdev->aux.mask || !pEvdev->aux.timer) {
+        EvdevFreeAuxFilter(pEvdev);
+        return FALSE;
     }
+
+    return TRUE;
+}
+
+static void
+EvdevFreeAuxFilter(EvdevPtr pEvdev)
+{
+    TimerFree(pEvdev->aux.timer);
+    pEvdev->aux.timer = NULL;
+    valuator_mask_free(&pEvdev->aux.mask);
+    free(pEvdev->aux.axes);
+    pEvdev->aux.axes = NULL;
 }
 
 /**
@@ -795,6 +1499,10 @@ EvdevProcessAbsoluteMotionEvent(InputInfoPtr pInfo, struct input_event *ev)
                 pEvdev->rel_queued = 1;
             }
         } else {
+            if (ev->code == ABS_PRESSURE)
+                value = EvdevMapPressure(pEvdev, 0, value);
+            if (map >= 2 && EvdevFilterAuxAxis(pInfo, ev, map, &value))
+                return;
             valuator_mask_set(pEvdev->abs_vals, map, value);
             pEvdev->abs_queued = 1;
         }
@@ -822,6 +1530,7 @@ EvdevProcessKeyEvent(InputInfoPtr pInfo, struct input_event *ev)
     {
         if (ev->code == proximity_bits[i])
         {
+            EvdevPredictSettlePointer(pInfo);
             EvdevProcessProximityEvent(pInfo, ev);
             return;
         }
@@ -829,6 +1538,7 @@ EvdevProcessKeyEvent(InputInfoPtr pInfo, struct input_event *ev)
 
     switch (ev->code) {
         case BTN_TOUCH:
+            EvdevPredictSettlePointer(pInfo);
             /* For devices that have but don't use proximity, use
              * BTN_TOUCH as the proximity notifier */
             if (!pEvdev->use_proximity)
@@ -1069,6 +1779,28 @@ static void handle_key(InputInfoPtr pInfo, int key_code, int pressed)
      }
 }
 
+/**
+ * Build mt_mask for a queued touch event from the values of its slot.
+ */
+static void
+EvdevFillTouchMask(EvdevPtr pEvdev, EventQueuePtr queue)
+{
+    const int32_t *vals = EvdevSlotVals(pEvdev, queue->detail.touch);
+    uint64_t changed = queue->touchChanged;
+
+    valuator_mask_zero(pEvdev->mt_mask);
+
+    if (changed & 1)
+        valuator_mask_set(pEvdev->mt_mask, 0, queue->touchX);
+    if (changed & 2)
+        valuator_mask_set(pEvdev->mt_mask, 1, queue->touchY);
+
+    for (changed &= ~3ULL; changed; changed &= changed - 1) {
+        int axis = __builtin_ctzll(changed);
+        valuator_mask_set(pEvdev->mt_mask, axis, vals[axis]);
+    }
+}
+
 /**
  * Post the queued key/button events.
  */
@@ -1099,28 +1831,111 @@ static void EvdevPostQueuedEvents(InputInfoPtr pInfo)
         case EV_QUEUE_PROXIMITY:
             break;
         case EV_QUEUE_TOUCH:
+            EvdevFillTouchMask(pEvdev, &pEvdev->queue[i]);
             xf86PostTouchEvent(pInfo->dev, pEvdev->queue[i].detail.touch,
                                pEvdev->queue[i].val, 0,
-                               pEvdev->queue[i].touchMask);
+                               pEvdev->mt_mask);
             break;
         }
     }
 }
 
+/**
+ * Called once no samples arrived for a while after an extrapolated frame.
+ * Posts the measured position of the pointer and of each touch whose last
+ * position was extrapolated, so the overshoot doesn't stay on screen.
+ */
+static CARD32
+EvdevPredictTimer(OsTimerPtr timer, CARD32 time, pointer arg)
+{
+    InputInfoPtr pInfo = arg;
+    EvdevPtr pEvdev = pInfo->private;
+    int slot;
+
+#if HAVE_THREADED_INPUT
+    input_lock();
+#else
+    int sigstate = xf86BlockSIGIO();
+#endif
+
+    EvdevPredictSettlePointer(pInfo);
+
+    for (slot = 0; pEvdev->mt_mask && slot < pEvdev->nslots; slot++) {
+        PredictorPtr p = &pEvdev->slot_predict[slot];
+        EventQueueRec touch = { 0 };
+        int x, y;
+
+        if (pEvdev->slot_state[slot] != SLOTSTATE_UPDATE || !p->extrapolated)
+            continue;
+
+        EvdevPredictReset(p);
+
+        x = EvdevSlotVals(pEvdev, slot)[0];
+        y = EvdevSlotVals(pEvdev, slot)[1];
+        EvdevTransformAbsCoords(pEvdev, &x, &y, &touch.touchX, &touch.touchY, 1);
+        touch.type = EV_QUEUE_TOUCH;
+        touch.detail.touch = slot;
+        touch.touchChanged = 3;
+        EvdevFillTouchMask(pEvdev, &touch);
+        xf86PostTouchEvent(pInfo->dev, slot, XI_TouchUpdate, 0,
+                           pEvdev->mt_mask);
+    }
+
+#if HAVE_THREADED_INPUT
+    input_unlock();
+#else
+    xf86UnblockSIGIO(sigstate);
+#endif
+
+    return 0;
+}
+
+static void EvdevProcessFrame(InputInfoPtr pInfo, CARD32 time);
+
 /**
  * Take the synchronization input event and process it accordingly; the motion
  * notify events are sent first, then any button/key press/release events.
  */
 static void
 EvdevProcessSyncEvent(InputInfoPtr pInfo, struct input_event *ev)
+{
+    EvdevPtr pEvdev = pInfo->private;
+    CARD32 time = ev->time.tv_sec * 1000 + ev->time.tv_usec / 1000;
+
+    if (pEvdev->latency.monotonic) {
+        /* the server's clock may lag behind the kernel timestamp */
+        int32_t latency = max((int32_t)(GetTimeInMillis() - time), 0);
+        int bucket = latency ? 32 - __builtin_clz(latency) : 0;
+
+        pEvdev->latency.hist[min(bucket, EVDEV_LATENCY_BUCKETS - 1)]++;
+    }
+
+    /* On relative devices, frames with nothing but motion are merged into
+     * rel_vals and posted as one event with the next other frame or at the
+     * end of EvdevReadInput, whichever comes first. */
+    if (pEvdev->rel_queued && !(pEvdev->flags & EVDEV_ABSOLUTE_EVENTS) &&
+        !pEvdev->prox_queued && pEvdev->num_queue == 0) {
+        pEvdev->rel_pending = TRUE;
+        pEvdev->rel_pending_time = time;
+        return;
+    }
+
+    EvdevProcessFrame(pInfo, time);
+}
+
+/**
+ * Process and post everything queued since the last frame.
+ */
+static void
+EvdevProcessFrame(InputInfoPtr pInfo, CARD32 time)
 {
     int i;
     EvdevPtr pEvdev = pInfo->private;
 
     EvdevProcessProximityState(pInfo);
 
-    EvdevProcessValuators(pInfo);
-    EvdevProcessTouch(pInfo);
+    EvdevProcessValuators(pInfo, time);
+    EvdevProcessTouch(pInfo, time);
 
     EvdevPostProximityEvents(pInfo, TRUE);
     EvdevPostRelativeMotionEvents(pInfo);
@@ -1128,13 +1943,18 @@ EvdevProcessSyncEvent(InputInfoPtr pInfo, struct input_event *ev)
     EvdevPostQueuedEvents(pInfo);
     EvdevPostProximityEvents(pInfo, FALSE);
 
-    for (i = 0; i < ArrayLength(pEvdev->queue); i++)
+    if (pEvdev->predict.extrapolated && pEvdev->predict.timer) {
+        TimerSet(pEvdev->predict.timer, 0, EVDEV_PREDICT_MAX_GAP,
+                 EvdevPredictTimer, pInfo);
+        pEvdev->predict.extrapolated = FALSE;
+    }
+
+    for (i = 0; i < pEvdev->num_queue; i++)
     {
         EventQueuePtr queue = &pEvdev->queue[i];
         queue->detail.key = 0;
         queue->type = 0;
         queue->val = 0;
-        /* don't reset the touchMask */
     }
 
     if (pEvdev->rel_vals)
@@ -1145,6 +1965,7 @@ EvdevProcessSyncEvent(InputInfoPtr pInfo, struct input_event *ev)
     pEvdev->abs_queued = 0;
     pEvdev->rel_queued = 0;
     pEvdev->prox_queued = 0;
+    pEvdev->rel_pending = FALSE;
 
 }
 
@@ -1152,7 +1973,7 @@ EvdevProcessSyncEvent(InputInfoPtr pInfo, struct input_event *ev)
  * Process the events from the device; nothing is actually posted to the server
  * until an EV_SYN event is received.
  */
-static void
+void
 EvdevProcessEvent(InputInfoPtr pInfo, struct input_event *ev)
 {
     switch (ev->type) {
@@ -1174,129 +1995,416 @@ EvdevProcessEvent(InputInfoPtr pInfo, struct input_event *ev)
 static void
 EvdevFreeMasks(EvdevPtr pEvdev)
 {
-    int i;
-
-    free(pEvdev->slots);
-    pEvdev->slots = NULL;
+    free(pEvdev->mt_slab);
+    pEvdev->mt_slab = NULL;
+    pEvdev->mt_slab_size = 0;
+    pEvdev->slot_changed = NULL;
+    pEvdev->slot_vals_set = NULL;
+    pEvdev->slot_vals = NULL;
+    pEvdev->slot_predict = NULL;
+    pEvdev->dirty_slots = NULL;
+    pEvdev->slot_state = NULL;
+    pEvdev->nslots = 0;
     valuator_mask_free(&pEvdev->abs_vals);
     valuator_mask_free(&pEvdev->rel_vals);
     valuator_mask_free(&pEvdev->old_vals);
     valuator_mask_free(&pEvdev->prox);
     valuator_mask_free(&pEvdev->mt_mask);
-    if (pEvdev->last_mt_vals)
-    {
-        for (i = 0; i < libevdev_get_num_slots(pEvdev->dev); i++)
-            valuator_mask_free(&pEvdev->last_mt_vals[i]);
-        free(pEvdev->last_mt_vals);
-        pEvdev->last_mt_vals = NULL;
-    }
-    for (i = 0; i < EVDEV_MAXQUEUE; i++)
-        valuator_mask_free(&pEvdev->queue[i].touchMask);
+    valuator_mask_free(&pEvdev->emulateWheel.kinetic_vals);
+    free(pEvdev->pressure.lut[0]);
+    free(pEvdev->pressure.lut[1]);
+    pEvdev->pressure.lut[0] = NULL;
+    pEvdev->pressure.lut[1] = NULL;
 }
 
-static void
-EvdevHandleMTDevEvent(InputInfoPtr pInfo, struct input_event *ev)
+/**
+ * Read the events libevdev generates to bring the device state up to date
+ * after SYN_DROPPED or a forced sync. The events are processed like any
+ * other if post is TRUE, discarded otherwise.
+ *
+ * @return the status of the last read
+ */
+static int
+EvdevSyncEvents(InputInfoPtr pInfo, BOOL post)
 {
     EvdevPtr pEvdev = pInfo->private;
+    struct input_event ev;
+    int rc;
 
-    mtdev_put_event(pEvdev->mtdev, ev);
-    if (libevdev_event_is_code(ev, EV_SYN, SYN_REPORT)) {
-        while (!mtdev_empty(pEvdev->mtdev)) {
-            struct input_event e;
-            mtdev_get_event(pEvdev->mtdev, &e);
-            EvdevProcessEvent(pInfo, &e);
+    rc = libevdev_next_event(pEvdev->dev, LIBEVDEV_READ_FLAG_SYNC, &ev);
+    while (rc == LIBEVDEV_READ_STATUS_SYNC) {
+        if (post) {
+            if (pEvdev->mtrack)
+                EvdevMTrackEvent(pInfo, &ev);
+            else
+                EvdevProcessEvent(pInfo, &ev);
         }
+        rc = libevdev_next_event(pEvdev->dev, LIBEVDEV_READ_FLAG_SYNC, &ev);
     }
+
+    return rc;
 }
 
+/**
+ * Bring libevdev's view of the device up to date after the fd changed.
+ *
+ * If the device stayed enabled while it was gone (see EvdevReopenTimer)
+ * every change is posted. Otherwise, e.g. on VT switch, the server has
+ * released all buttons and touches already and only what libevdev itself
+ * needs is synced: the slot state it sanitizes touches against and the
+ * axis ranges the driver scales with. A full sync reads every key, LED,
+ * switch and axis of the device and queues the differences, devices
+ * without absolute axes, e.g. mice and keyboards, skip it altogether.
+ */
 static void
-EvdevReadInput(InputInfoPtr pInfo)
+EvdevResync(InputInfoPtr pInfo, BOOL post)
 {
-    int rc = 0;
     EvdevPtr pEvdev = pInfo->private;
-    struct input_event ev;
+    struct timespec start, end;
+    int i;
 
-    do {
-        rc = libevdev_next_event(pEvdev->dev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-        if (rc < 0) {
-            if (rc == -ENODEV) /* May happen after resume */
-                xf86RemoveEnabledDevice(pInfo);
-            else if (rc != -EAGAIN)
-                LogMessageVerbSigSafe(X_ERROR, 0, "%s: Read error: %s\n", pInfo->name,
-                                       strerror(-rc));
-            break;
-        } else if (rc == LIBEVDEV_READ_STATUS_SUCCESS) {
-            if (pEvdev->mtdev)
-                EvdevHandleMTDevEvent(pInfo, &ev);
-            else
-                EvdevProcessEvent(pInfo, &ev);
-        }
-        else { /* SYN_DROPPED */
-            rc = libevdev_next_event(pEvdev->dev, LIBEVDEV_READ_FLAG_SYNC, &ev);
-            while (rc == LIBEVDEV_READ_STATUS_SYNC) {
-                if (pEvdev->mtdev)
-                    EvdevHandleMTDevEvent(pInfo, &ev);
-                else
-                    EvdevProcessEvent(pInfo, &ev);
-                rc = libevdev_next_event(pEvdev->dev, LIBEVDEV_READ_FLAG_SYNC, &ev);
-            }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (post || libevdev_has_event_code(pEvdev->dev, EV_ABS, ABS_MT_SLOT)) {
+        struct input_event ev;
+
+        libevdev_next_event(pEvdev->dev, LIBEVDEV_READ_FLAG_FORCE_SYNC, &ev);
+        EvdevSyncEvents(pInfo, post);
+        if (!post)
+            EvdevResetSlots(pEvdev);
+    } else if (libevdev_has_event_type(pEvdev->dev, EV_ABS)) {
+        for (i = ABS_X; i <= ABS_MAX; i++) {
+            struct input_absinfo abs;
+
+            if (libevdev_has_event_code(pEvdev->dev, EV_ABS, i) &&
+                ioctl(pInfo->fd, EVIOCGABS(i), &abs) == 0)
+                libevdev_set_abs_info(pEvdev->dev, i, &abs);
         }
-    } while (rc == LIBEVDEV_READ_STATUS_SUCCESS);
-}
+    }
 
-static void
-EvdevPtrCtrlProc(DeviceIntPtr device, PtrCtrl *ctrl)
-{
-    /* Nothing to do, dix handles all settings */
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    xf86IDrvMsgVerb(pInfo, X_INFO, 7, "Resync took %ld us\n",
+                    (end.tv_sec - start.tv_sec) * 1000000L +
+                    (end.tv_nsec - start.tv_nsec) / 1000);
 }
 
-static void
-EvdevKbdCtrl(DeviceIntPtr device, KeybdCtrl *ctrl)
+#define REOPEN_DELAY      100  /* ms before the first attempt */
+#define REOPEN_MAX_DELAY  5000 /* ms */
+
+/**
+ * FNV-1a hash of the key, relative and absolute code bitmaps the kernel
+ * reports for the device behind pInfo->fd.
+ *
+ * @return FALSE if the bitmaps couldn't be read
+ */
+static BOOL
+EvdevHashCaps(InputInfoPtr pInfo, uint32_t *hash)
 {
-    static struct { int xbit, code; } bits[] = {
-        { CAPSFLAG,	LED_CAPSL },
-        { NUMFLAG,	LED_NUML },
-        { SCROLLFLAG,	LED_SCROLLL },
-        { MODEFLAG,	LED_KANA },
-        { COMPOSEFLAG,	LED_COMPOSE }
+    static const struct { int type; size_t len; } bits[] = {
+        { EV_KEY, NLONGS(KEY_CNT) * sizeof(unsigned long) },
+        { EV_REL, NLONGS(REL_CNT) * sizeof(unsigned long) },
+        { EV_ABS, NLONGS(ABS_CNT) * sizeof(unsigned long) },
     };
-
-    InputInfoPtr pInfo;
-    struct input_event ev[ArrayLength(bits) + 1];
+    unsigned long mask[NLONGS(KEY_CNT)];
+    const unsigned char *byte = (const unsigned char *)mask;
+    uint32_t h = 2166136261U;
+    size_t j;
     int i;
-    int rc;
 
-    memset(ev, 0, sizeof(ev));
-
-    pInfo = device->public.devicePrivate;
     for (i = 0; i < ArrayLength(bits); i++) {
-        ev[i].type = EV_LED;
-        ev[i].code = bits[i].code;
-        ev[i].value = (ctrl->leds & bits[i].xbit) > 0;
-    }
+        memset(mask, 0, bits[i].len);
+        if (ioctl(pInfo->fd, EVIOCGBIT(bits[i].type, bits[i].len), mask) < 0)
+            return FALSE;
 
-    ev[i].type = EV_SYN;
-    ev[i].code = SYN_REPORT;
-    ev[i].value = 0;
+        for (j = 0; j < bits[i].len; j++)
+            h = (h ^ byte[j]) * 16777619U;
+    }
 
-    rc = write(pInfo->fd, ev, sizeof ev);
-    if (rc != sizeof ev)
-	    xf86IDrvMsg(pInfo, X_ERROR, "Failed to set keyboard controls: %s\n", strerror(errno));
+    *hash = h;
+    return TRUE;
 }
 
-static int
-EvdevAddKeyClass(DeviceIntPtr device)
+/**
+ * Return TRUE if the device behind pInfo->fd is the one we probed, the
+ * node may have been taken by a different device while ours was gone.
+ * pEvdev->dev can't tell, the probe and wheel emulation enable codes the
+ * kernel doesn't report, so compare against the bitmaps of the first open.
+ */
+static BOOL
+EvdevIsSameDevice(InputInfoPtr pInfo)
 {
-    int rc = Success;
-    XkbRMLVOSet rmlvo = {0},
-                defaults;
-    InputInfoPtr pInfo;
-
-    pInfo = device->public.devicePrivate;
+    EvdevPtr pEvdev = pInfo->private;
+    struct input_id id;
+    uint32_t hash;
+
+    if (ioctl(pInfo->fd, EVIOCGID, &id) < 0 ||
+        id.bustype != libevdev_get_id_bustype(pEvdev->dev) ||
+        id.vendor != libevdev_get_id_vendor(pEvdev->dev) ||
+        id.product != libevdev_get_id_product(pEvdev->dev) ||
+        id.version != libevdev_get_id_version(pEvdev->dev))
+        return FALSE;
 
-    XkbGetRulesDflts(&defaults);
+    return EvdevHashCaps(pInfo, &hash) && hash == pEvdev->kernel_caps;
+}
 
-    /* sorry, no rules change allowed for you */
+/**
+ * Try to open the device again after it went away. The delay between
+ * attempts doubles up to REOPEN_MAX_DELAY, docks can take several seconds
+ * to come back after resume. The device stays enabled meanwhile, once it
+ * is back the state changes are posted like after SYN_DROPPED.
+ */
+static CARD32
+EvdevReopenTimer(OsTimerPtr timer, CARD32 time, pointer arg)
+{
+    InputInfoPtr pInfo = arg;
+    EvdevPtr pEvdev = pInfo->private;
+    BOOL disable = FALSE;
+    CARD32 delay = 0;
+    int attempt;
+
+#if HAVE_THREADED_INPUT
+    input_lock();
+#else
+    int sigstate = xf86BlockSIGIO();
+#endif
+
+    attempt = ++pEvdev->reopen_count;
+
+    do {
+        pInfo->fd = open(pEvdev->device, O_RDWR | O_NONBLOCK, 0);
+    } while (pInfo->fd < 0 && errno == EINTR);
+
+    if (pInfo->fd >= 0)
+    {
+        pEvdev->reopen_count = 0;
+
+        if (!EvdevIsSameDevice(pInfo))
+        {
+            xf86IDrvMsg(pInfo, X_ERROR, "Device has changed - disabling.\n");
+            close(pInfo->fd);
+            pInfo->fd = -1;
+            disable = TRUE;
+        } else if (EvdevOpenDevice(pInfo) != Success)
+            disable = TRUE;
+        else {
+            EvdevGrabDevice(pInfo, 1, 0);
+            xf86AddEnabledDevice(pInfo);
+            /* the server only sets the LEDs again when the lock state
+             * changes, restore what it last asked for */
+            if (pEvdev->flags & EVDEV_KEYBOARD_EVENTS)
+                EvdevWriteLeds(pInfo);
+            xf86IDrvMsg(pInfo, X_INFO, "Device reopened after %d attempts.\n",
+                        attempt);
+        }
+    }
+    /* the limit may have been lowered meanwhile */
+    else if (attempt >= pEvdev->reopen_attempts)
+    {
+        xf86IDrvMsg(pInfo, X_ERROR, "Failed to reopen device after %d attempts.\n",
+                    attempt);
+        disable = TRUE;
+    } else {
+        delay = REOPEN_DELAY << min(attempt, 6);
+        delay = min(delay, REOPEN_MAX_DELAY);
+    }
+
+#if HAVE_THREADED_INPUT
+    input_unlock();
+#else
+    xf86UnblockSIGIO(sigstate);
+#endif
+
+    if (disable)
+        xf86DisableDevice(pInfo->dev, FALSE);
+
+    return delay;
+}
+
+/**
+ * The device node went away, e.g. on suspend. Close it and start trying
+ * to open it again, see EvdevReopenTimer.
+ */
+static void
+EvdevStartReopen(InputInfoPtr pInfo)
+{
+    EvdevPtr pEvdev = pInfo->private;
+
+    /* the server reopens devices it opened for us itself */
+    if ((pInfo->flags & XI86_SERVER_FD) || !pEvdev->reopen_timer ||
+        !pEvdev->reopen_attempts)
+        return;
+
+    close(pInfo->fd);
+    pInfo->fd = -1;
+    /* don't hog the device number while we're waiting */
+    EvdevRemoveOpenDevice(pEvdev);
+    pEvdev->leds.written = -1;
+
+    pEvdev->reopen_count = 0;
+    TimerSet(pEvdev->reopen_timer, 0, REOPEN_DELAY, EvdevReopenTimer, pInfo);
+}
+
+static void
+EvdevReadInput(InputInfoPtr pInfo)
+{
+    int rc = 0;
+    EvdevPtr pEvdev = pInfo->private;
+    struct input_event ev;
+
+    do {
+        rc = libevdev_next_event(pEvdev->dev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
+        if (rc < 0) {
+            if (rc == -ENODEV) { /* May happen after resume */
+                xf86RemoveEnabledDevice(pInfo);
+                EvdevStartReopen(pInfo);
+            } else if (rc != -EAGAIN)
+                LogMessageVerbSigSafe(X_ERROR, 0, "%s: Read error: %s\n", pInfo->name,
+                                       strerror(-rc));
+            break;
+        } else if (rc == LIBEVDEV_READ_STATUS_SUCCESS) {
+            if (pEvdev->mtrack)
+                EvdevMTrackEvent(pInfo, &ev);
+            else
+                EvdevProcessEvent(pInfo, &ev);
+        }
+        else /* SYN_DROPPED */
+            rc = EvdevSyncEvents(pInfo, TRUE);
+    } while (rc == LIBEVDEV_READ_STATUS_SUCCESS);
+
+    if (pEvdev->rel_pending)
+        EvdevProcessFrame(pInfo, pEvdev->rel_pending_time);
+}
+
+static void
+EvdevPtrCtrlProc(DeviceIntPtr device, PtrCtrl *ctrl)
+{
+    /* Nothing to do, dix handles all settings */
+}
+
+static struct { int xbit, code; } led_bits[] = {
+    { CAPSFLAG,	LED_CAPSL },
+    { NUMFLAG,	LED_NUML },
+    { SCROLLFLAG,	LED_SCROLLL },
+    { MODEFLAG,	LED_KANA },
+    { COMPOSEFLAG,	LED_COMPOSE }
+};
+
+#define LED_DELAY 10 /* ms to collect LED changes before writing them */
+
+/**
+ * Write the LEDs that differ from what the device was last set to, all
+ * in one write. Takes the input lock, a read error on the input thread
+ * may close the fd meanwhile.
+ */
+static void
+EvdevWriteLeds(InputInfoPtr pInfo)
+{
+    EvdevPtr pEvdev = pInfo->private;
+    struct input_event ev[ArrayLength(led_bits) + 1];
+    int changed;
+    int i, n = 0;
+    int rc;
+
+#if HAVE_THREADED_INPUT
+    input_lock();
+#else
+    int sigstate = xf86BlockSIGIO();
+#endif
+
+    pEvdev->leds.pending = FALSE;
+
+    /* the device is being reopened, write everything once it's back */
+    if (pInfo->fd < 0) {
+        pEvdev->leds.written = -1;
+        goto out;
+    }
+
+    changed = pEvdev->leds.wanted ^ pEvdev->leds.written;
+    memset(ev, 0, sizeof(ev));
+
+    for (i = 0; i < ArrayLength(led_bits); i++) {
+        if (!(changed & (1 << i)))
+            continue;
+        ev[n].type = EV_LED;
+        ev[n].code = led_bits[i].code;
+        ev[n].value = (pEvdev->leds.wanted & (1 << i)) != 0;
+        n++;
+    }
+
+    if (n == 0)
+        goto out;
+
+    ev[n].type = EV_SYN;
+    ev[n].code = SYN_REPORT;
+    ev[n].value = 0;
+    n++;
+
+    rc = write(pInfo->fd, ev, n * sizeof(ev[0]));
+    if (rc != n * sizeof(ev[0])) {
+	    xf86IDrvMsg(pInfo, X_ERROR, "Failed to set keyboard controls: %s\n", strerror(errno));
+	    pEvdev->leds.written = -1;
+    } else
+	    pEvdev->leds.written = pEvdev->leds.wanted;
+
+out:
+#if HAVE_THREADED_INPUT
+    input_unlock();
+#else
+    xf86UnblockSIGIO(sigstate);
+#endif
+}
+
+static CARD32
+EvdevLedTimer(OsTimerPtr timer, CARD32 time, pointer arg)
+{
+    EvdevWriteLeds(arg);
+    return 0;
+}
+
+static void
+EvdevKbdCtrl(DeviceIntPtr device, KeybdCtrl *ctrl)
+{
+    InputInfoPtr pInfo;
+    EvdevPtr pEvdev;
+    int i;
+
+    pInfo = device->public.devicePrivate;
+    pEvdev = pInfo->private;
+
+    pEvdev->leds.wanted = 0;
+    for (i = 0; i < ArrayLength(led_bits); i++)
+        if (ctrl->leds & led_bits[i].xbit)
+            pEvdev->leds.wanted |= 1 << i;
+
+    /* Some keyboards stall while they update their LEDs, so don't write
+     * what the device already shows and collect the changes of a burst of
+     * lock state updates into one write. */
+    if (pEvdev->leds.pending || pEvdev->leds.wanted == pEvdev->leds.written)
+        return;
+
+    if (!pEvdev->leds.timer)
+        pEvdev->leds.timer = TimerSet(NULL, 0, 0, NULL, NULL);
+
+    if (pEvdev->leds.timer) {
+        pEvdev->leds.pending = TRUE;
+        TimerSet(pEvdev->leds.timer, 0, LED_DELAY, EvdevLedTimer, pInfo);
+    } else
+        EvdevWriteLeds(pInfo);
+}
+
+static int
+EvdevAddKeyClass(DeviceIntPtr device)
+{
+    int rc = Success;
+    XkbRMLVOSet rmlvo = {0},
+                defaults;
+    InputInfoPtr pInfo;
+
+    pInfo = device->public.devicePrivate;
+
+    XkbGetRulesDflts(&defaults);
+
+    /* sorry, no rules change allowed for you */
     xf86ReplaceStrOption(pInfo->options, "xkb_rules", "evdev");
     rmlvo.rules = xf86SetStrOption(pInfo->options, "xkb_rules", NULL);
     rmlvo.model = xf86SetStrOption(pInfo->options, "xkb_model", defaults.model);
@@ -1507,44 +2615,11 @@ EvdevAddAbsValuatorClass(DeviceIntPtr device, int num_scroll_axes)
             goto out;
         }
 
-        pEvdev->slots = calloc(nslots, sizeof(*pEvdev->slots));
-        if (!pEvdev->slots) {
-            xf86Msg(X_ERROR, "%s: failed to allocate slot state array.\n",
+        if (!EvdevAllocSlots(pEvdev, nslots)) {
+            xf86Msg(X_ERROR, "%s: failed to allocate slot state.\n",
                     device->name);
             goto out;
         }
-        for (i = 0; i < nslots; i++) {
-            pEvdev->slots[i].state = SLOTSTATE_EMPTY;
-            pEvdev->slots[i].dirty = 0;
-        }
-
-        pEvdev->last_mt_vals = calloc(nslots, sizeof(ValuatorMask *));
-        if (!pEvdev->last_mt_vals) {
-            xf86IDrvMsg(pInfo, X_ERROR,
-                        "%s: failed to allocate MT last values mask array.\n",
-                        device->name);
-            goto out;
-        }
-
-        for (i = 0; i < nslots; i++) {
-            pEvdev->last_mt_vals[i] = valuator_mask_new(num_mt_axes_total);
-            if (!pEvdev->last_mt_vals[i]) {
-                xf86IDrvMsg(pInfo, X_ERROR,
-                            "%s: failed to allocate MT last values mask.\n",
-                            device->name);
-                goto out;
-            }
-        }
-
-        for (i = 0; i < EVDEV_MAXQUEUE; i++) {
-            pEvdev->queue[i].touchMask =
-                valuator_mask_new(num_mt_axes_total);
-            if (!pEvdev->queue[i].touchMask) {
-                xf86Msg(X_ERROR, "%s: failed to allocate MT valuator masks for "
-                        "evdev event queue.\n", device->name);
-                goto out;
-            }
-        }
     }
     atoms = malloc((pEvdev->num_vals + num_mt_axes) * sizeof(Atom));
 
@@ -1614,11 +2689,9 @@ EvdevAddAbsValuatorClass(DeviceIntPtr device, int num_scroll_axes)
         for (i = 0; i < num_touches; i++) {
             for (axis = ABS_MT_TOUCH_MAJOR; axis <= ABS_MAX; axis++) {
                 if (pEvdev->abs_axis_map[axis] >= 0) {
-                    int val = pEvdev->mtdev ? 0 : libevdev_get_current_slot(pEvdev->dev);
-                    /* XXX: read initial values from mtdev when it adds support
-                     *      for doing so. */
-                    valuator_mask_set(pEvdev->last_mt_vals[i],
-                                      pEvdev->abs_axis_map[axis], val);
+                    int val = pEvdev->mtrack ? 0 : libevdev_get_current_slot(pEvdev->dev);
+                    EvdevSlotVals(pEvdev, i)[pEvdev->abs_axis_map[axis]] = val;
+                    pEvdev->slot_vals_set[i] |= 1ULL << pEvdev->abs_axis_map[axis];
                 }
             }
         }
@@ -1646,6 +2719,8 @@ EvdevAddAbsValuatorClass(DeviceIntPtr device, int num_scroll_axes)
         xf86InitValuatorDefaults(device, axnum);
     }
 
+    EvdevUpdateAbsTransform(pEvdev);
+
     for (axis = ABS_MT_TOUCH_MAJOR; axis <= ABS_MAX; axis++) {
         const struct input_absinfo *abs;
         int axnum = pEvdev->abs_axis_map[axis];
@@ -1693,7 +2768,8 @@ EvdevAddAbsValuatorClass(DeviceIntPtr device, int num_scroll_axes)
                                        0, 0, 0, Relative);
             SetScrollValuator(device, pEvdev->rel_axis_map[idx],
                               SCROLL_TYPE_VERTICAL,
-                              -pEvdev->smoothScroll.vert_delta,
+                              -pEvdev->smoothScroll.vert_delta *
+                              pEvdev->smoothScroll.vert_units,
                               SCROLL_FLAG_PREFERRED);
         }
 
@@ -1707,7 +2783,8 @@ EvdevAddAbsValuatorClass(DeviceIntPtr device, int num_scroll_axes)
                                        0, 0, 0, Relative);
             SetScrollValuator(device, pEvdev->rel_axis_map[idx],
                               SCROLL_TYPE_HORIZONTAL,
-                              pEvdev->smoothScroll.horiz_delta,
+                              pEvdev->smoothScroll.horiz_delta *
+                              pEvdev->smoothScroll.horiz_units,
                               SCROLL_FLAG_NONE);
         }
 
@@ -1752,6 +2829,10 @@ EvdevAddAbsValuatorClass(DeviceIntPtr device, int num_scroll_axes)
         goto out;
     }
 
+    if (!EvdevUpdatePressureCurve(pEvdev, pEvdev->pressure.curve))
+        xf86IDrvMsg(pInfo, X_WARNING,
+                    "failed to allocate pressure curve, using a linear curve\n");
+
     if (pEvdev->flags & EVDEV_TOUCHPAD)
         pEvdev->flags |= EVDEV_RELATIVE_MODE;
     else
@@ -1790,7 +2871,8 @@ EvdevSetScrollValuators(DeviceIntPtr device)
     axnum = pEvdev->rel_axis_map[REL_WHEEL];
     if (axnum != -1) {
         SetScrollValuator(device, axnum, SCROLL_TYPE_VERTICAL,
-                          -pEvdev->smoothScroll.vert_delta,
+                          -pEvdev->smoothScroll.vert_delta *
+                          pEvdev->smoothScroll.vert_units,
                           SCROLL_FLAG_PREFERRED);
     }
 
@@ -1804,7 +2886,8 @@ EvdevSetScrollValuators(DeviceIntPtr device)
     axnum = pEvdev->rel_axis_map[REL_HWHEEL];
     if (axnum != -1) {
         SetScrollValuator(device, axnum, SCROLL_TYPE_HORIZONTAL,
-                          pEvdev->smoothScroll.horiz_delta,
+                          pEvdev->smoothScroll.horiz_delta *
+                          pEvdev->smoothScroll.horiz_units,
                           SCROLL_FLAG_NONE);
     }
 
@@ -1826,7 +2909,8 @@ EvdevAddRelValuatorClass(DeviceIntPtr device, int num_scroll_axes)
         goto out;
 
     for (i = 0; i <= REL_MAX; i++) {
-        if (i == REL_WHEEL || i == REL_HWHEEL || i == REL_DIAL)
+        if (i == REL_WHEEL || i == REL_HWHEEL || i == REL_DIAL ||
+            i == REL_WHEEL_HI_RES || i == REL_HWHEEL_HI_RES)
             continue;
 
         if (libevdev_has_event_code(pEvdev->dev, EV_REL, i))
@@ -1859,6 +2943,9 @@ EvdevAddRelValuatorClass(DeviceIntPtr device, int num_scroll_axes)
         pEvdev->rel_axis_map[axis] = -1;
         if (!libevdev_has_event_code(pEvdev->dev, EV_REL, axis))
             continue;
+        /* posted on the REL_WHEEL/REL_HWHEEL valuators */
+        if (axis == REL_WHEEL_HI_RES || axis == REL_HWHEEL_HI_RES)
+            continue;
         pEvdev->rel_axis_map[axis] = map;
         map++;
     }
@@ -2057,15 +3144,44 @@ EvdevInitTouchDevice(DeviceIntPtr device, EvdevPtr pEvdev)
     EvdevInitAbsValuators(device, pEvdev);
 }
 
+/**
+ * Memory held by the driver for this device, excluding the valuator masks
+ * (their size is private to the server) and libevdev.
+ */
+static size_t
+EvdevStateSize(EvdevPtr pEvdev)
+{
+    size_t size = sizeof(EvdevRec) + pEvdev->mt_slab_size;
+    int i;
+
+    for (i = 0; i < 2; i++)
+        if (pEvdev->pressure.lut[i])
+            size += (pEvdev->pressure.max[i] - pEvdev->pressure.min[i] + 1) *
+                    sizeof(int32_t);
+    if (pEvdev->aux.axes)
+        size += MAX_VALUATORS * sizeof(*pEvdev->aux.axes);
+    if (pEvdev->dragLock.lock_pair)
+        size += EVDEV_MAXBUTTONS * (sizeof(unsigned int) + sizeof(BOOL));
+    if (pEvdev->emulateWheel.X.samples)
+        size += 2 * EVDEV_WHEEL_SAMPLES * sizeof(WheelSample);
+    if (pEvdev->mtrack)
+        size += EvdevMTrackSize();
+
+    return size;
+}
+
 static int
 EvdevInit(DeviceIntPtr device)
 {
     InputInfoPtr pInfo;
     EvdevPtr pEvdev;
+    struct timespec start, end;
 
     pInfo = device->public.devicePrivate;
     pEvdev = pInfo->private;
 
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
     if (pEvdev->flags & EVDEV_KEYBOARD_EVENTS)
 	EvdevAddKeyClass(device);
     if (pEvdev->flags & EVDEV_BUTTON_EVENTS)
@@ -2096,16 +3212,28 @@ EvdevInit(DeviceIntPtr device)
     else if (pEvdev->flags & EVDEV_ABSOLUTE_EVENTS)
         EvdevInitAbsValuators(device, pEvdev);
 
-    /* We drop the return value, the only time we ever want the handlers to
-     * unregister is when the device dies. In which case we don't have to
-     * unregister anyway */
+    pEvdev->props = 0;
     EvdevInitProperty(device);
-    XIRegisterPropertyHandler(device, EvdevSetProperty, NULL, NULL);
     EvdevMBEmuInitProperty(device);
     Evdev3BEmuInitProperty(device);
     EvdevWheelEmuInitProperty(device);
     EvdevDragLockInitProperty(device);
     EvdevAppleInitProperty(device);
+    EvdevPredictInitProperty(device);
+    /* We drop the return value, the only time we ever want the handlers to
+     * unregister is when the device dies. In which case we don't have to
+     * unregister anyway. The one handler serves the properties of all
+     * modules, see EvdevRegisterProperty. It is registered last so the
+     * initial values aren't checked. */
+    XIRegisterPropertyHandler(device, EvdevSetProperty, EvdevGetProperty, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    xf86IDrvMsgVerb(pInfo, X_INFO, 7, "Init took %ld us\n",
+                    (end.tv_sec - start.tv_sec) * 1000000L +
+                    (end.tv_nsec - start.tv_nsec) / 1000);
+
+    xf86IDrvMsgVerb(pInfo, X_INFO, 7, "Driver state: %zu bytes\n",
+                    EvdevStateSize(pEvdev));
 
     return Success;
 }
@@ -2129,6 +3257,14 @@ EvdevOn(DeviceIntPtr device)
 
     EvdevGrabDevice(pInfo, 1, 0);
 
+    /* allocated here so EvdevReadInput never has to */
+    if (!pEvdev->reopen_timer)
+        pEvdev->reopen_timer = TimerSet(NULL, 0, 0, NULL, NULL);
+    if ((pEvdev->flags & EVDEV_ABSOLUTE_EVENTS) && !pEvdev->predict.timer) {
+        pEvdev->predict.timer = TimerSet(NULL, 0, 0, NULL, NULL);
+        pEvdev->predict.mask = valuator_mask_new(2);
+    }
+
     xf86FlushInput(pInfo->fd);
     xf86AddEnabledDevice(pInfo);
     EvdevMBEmuOn(pInfo);
@@ -2162,6 +3298,18 @@ EvdevProc(DeviceIntPtr device, int what)
         {
             EvdevMBEmuFinalize(pInfo);
             Evdev3BEmuFinalize(pInfo);
+            EvdevWheelEmuFinalize(pInfo);
+        }
+        TimerCancel(pEvdev->reopen_timer);
+        pEvdev->reopen_count = 0;
+        TimerCancel(pEvdev->predict.timer);
+        /* the console may change the LEDs while we're off */
+        TimerCancel(pEvdev->leds.timer);
+        pEvdev->leds.pending = FALSE;
+        pEvdev->leds.written = -1;
+        if (pEvdev->aux.axes) {
+            TimerCancel(pEvdev->aux.timer);
+            memset(pEvdev->aux.axes, 0, MAX_VALUATORS * sizeof(*pEvdev->aux.axes));
         }
         if (pInfo->fd != -1)
         {
@@ -2169,6 +3317,7 @@ EvdevProc(DeviceIntPtr device, int what)
             xf86RemoveEnabledDevice(pInfo);
             EvdevCloseDevice(pInfo);
         }
+        EvdevResetSlots(pEvdev);
         pEvdev->min_maj = 0;
         pEvdev->flags &= ~EVDEV_INITIALIZED;
 	device->public.on = FALSE;
@@ -2273,6 +3422,20 @@ EvdevForceXY(InputInfoPtr pInfo, int mode)
     }
 }
 
+static int
+EvdevNonNegativeOption(InputInfoPtr pInfo, const char *name)
+{
+    int val = xf86SetIntOption(pInfo->options, name, 0);
+
+    if (val < 0) {
+        xf86IDrvMsg(pInfo, X_WARNING, "Invalid %s value: %d\n", name, val);
+        xf86IDrvMsg(pInfo, X_WARNING, "Using built-in value: 0\n");
+        val = 0;
+    }
+
+    return val;
+}
+
 static int
 EvdevProbe(InputInfoPtr pInfo)
 {
@@ -2480,6 +3643,7 @@ EvdevProbe(InputInfoPtr pInfo)
             xf86IDrvMsg(pInfo, X_ERROR, "Resolution must be a positive number");
             pEvdev->resolution = 0;
         }
+        EvdevUpdateRelTransform(pEvdev);
 
         str = xf86CheckStrOption(pInfo->options, "Calibration", NULL);
         if (str) {
@@ -2494,6 +3658,43 @@ EvdevProbe(InputInfoPtr pInfo)
                             "Insufficient calibration factors (%d). Ignoring calibration\n",
                             num_calibration);
         }
+
+        pEvdev->hysteresis.threshold[0] =
+            EvdevNonNegativeOption(pInfo, "HysteresisX");
+        pEvdev->hysteresis.threshold[1] =
+            EvdevNonNegativeOption(pInfo, "HysteresisY");
+
+        pEvdev->aux.deadzone = EvdevNonNegativeOption(pInfo, "AuxDeadzone");
+        pEvdev->aux.min_change = EvdevNonNegativeOption(pInfo, "AuxMinChange");
+        pEvdev->aux.max_rate = EvdevNonNegativeOption(pInfo, "AuxMaxRate");
+        if ((pEvdev->aux.deadzone || pEvdev->aux.min_change ||
+             pEvdev->aux.max_rate) && !EvdevAllocAuxFilter(pEvdev)) {
+            xf86IDrvMsg(pInfo, X_ERROR, "Auxiliary axis filter disabled, out of memory\n");
+            pEvdev->aux.deadzone = pEvdev->aux.min_change = pEvdev->aux.max_rate = 0;
+        }
+
+        str = xf86CheckStrOption(pInfo->options, "PressureCurve", NULL);
+        if (str) {
+            int curve[4];
+
+            if (sscanf(str, "%d %d %d %d", &curve[0], &curve[1],
+                       &curve[2], &curve[3]) == 4 &&
+                curve[0] >= 0 && curve[0] <= 100 &&
+                curve[1] >= 0 && curve[1] <= 100 &&
+                curve[2] >= 0 && curve[2] <= 100 &&
+                curve[3] >= 0 && curve[3] <= 100)
+                memcpy(pEvdev->pressure.curve, curve, sizeof(curve));
+            else
+                xf86IDrvMsg(pInfo, X_ERROR,
+                            "Invalid pressure curve \"%s\", using a linear curve\n",
+                            str);
+            free(str);
+        }
+
+        if (libevdev_has_event_code(pEvdev->dev, EV_ABS, ABS_MT_POSITION_X))
+            EvdevPalmPreInit(pInfo);
+
+        EvdevPredictPreInit(pInfo);
     }
 
     if (has_rel_axes || has_abs_axes || num_buttons) {
@@ -2538,6 +3739,17 @@ EvdevProbe(InputInfoPtr pInfo)
             xf86SetIntOption(pInfo->options, "HorizScrollDelta", 1);
         pEvdev->smoothScroll.dial_delta =
             xf86SetIntOption(pInfo->options, "DialDelta", 1);
+
+        if (libevdev_has_event_code(pEvdev->dev, EV_REL, REL_WHEEL) &&
+            libevdev_has_event_code(pEvdev->dev, EV_REL, REL_WHEEL_HI_RES)) {
+            xf86IDrvMsg(pInfo, X_PROBED, "Found high-resolution scroll wheel\n");
+            pEvdev->smoothScroll.vert_units = HIRES_SCROLL_UNITS;
+        }
+        if (libevdev_has_event_code(pEvdev->dev, EV_REL, REL_HWHEEL) &&
+            libevdev_has_event_code(pEvdev->dev, EV_REL, REL_HWHEEL_HI_RES)) {
+            xf86IDrvMsg(pInfo, X_PROBED, "Found high-resolution horizontal scroll wheel\n");
+            pEvdev->smoothScroll.horiz_units = HIRES_SCROLL_UNITS;
+        }
     }
 
 out:
@@ -2547,6 +3759,16 @@ out:
     return rc;
 }
 
+static void
+EvdevPalmPreInit(InputInfoPtr pInfo)
+{
+    EvdevPtr pEvdev = pInfo->private;
+
+    pEvdev->palm.touch_major = EvdevNonNegativeOption(pInfo, "PalmTouchMajor");
+    pEvdev->palm.pressure = EvdevNonNegativeOption(pInfo, "PalmPressure");
+    pEvdev->palm.max_touches = EvdevNonNegativeOption(pInfo, "MaxTouches");
+}
+
 static void
 EvdevSetCalibration(InputInfoPtr pInfo, int num_calibration, int calibration[4])
 {
@@ -2565,55 +3787,28 @@ EvdevSetCalibration(InputInfoPtr pInfo, int num_calibration, int calibration[4])
         pEvdev->calibration.min_y = calibration[2];
         pEvdev->calibration.max_y = calibration[3];
     }
+
+    EvdevUpdateAbsTransform(pEvdev);
 }
 
 /**
- * Open an mtdev device for this device. mtdev is a bit too generous with
- * memory usage, so only do so for multitouch protocol A devices.
+ * Set up multitouch state for this device. Protocol A devices need their
+ * contacts tracked in the driver, see mtrack.c.
  *
- * @return FALSE on error, TRUE if mtdev was initiated or the device doesn't
+ * @return FALSE on error, TRUE if tracking was set up or the device doesn't
  * need it
  */
 static Bool
-EvdevOpenMTDev(InputInfoPtr pInfo)
+EvdevOpenMTrack(InputInfoPtr pInfo)
 {
     EvdevPtr pEvdev = pInfo->private;
 
-    if (pEvdev->mtdev) {
-        pEvdev->cur_slot = pEvdev->mtdev->caps.slot.value;
-        return TRUE;
-    } else if (libevdev_has_event_code(pEvdev->dev, EV_ABS, ABS_MT_SLOT)) {
+    if (libevdev_has_event_code(pEvdev->dev, EV_ABS, ABS_MT_SLOT)) {
         pEvdev->cur_slot = libevdev_get_current_slot(pEvdev->dev);
         return TRUE;
     }
 
-    if (pInfo->fd < 0) {
-        xf86Msg(X_ERROR, "%s: Bug. fd < 0\n", pInfo->name);
-        return FALSE;
-    }
-
-    if (!libevdev_has_event_type(pEvdev->dev, EV_ABS))
-        return TRUE;
-
-    /* don't need mtdev for protocol B devices */
-    if (libevdev_has_event_code(pEvdev->dev, EV_ABS, ABS_MT_SLOT))
-        return TRUE;
-
-    if (!libevdev_has_event_code(pEvdev->dev, EV_ABS, ABS_MT_POSITION_X) ||
-        !libevdev_has_event_code(pEvdev->dev, EV_ABS, ABS_MT_POSITION_Y))
-        return TRUE;
-
-    xf86IDrvMsg(pInfo, X_INFO, "Using mtdev for this device\n");
-    pEvdev->mtdev = mtdev_new_open(pInfo->fd);
-    if (pEvdev->mtdev)
-        pEvdev->cur_slot = pEvdev->mtdev->caps.slot.value;
-    else {
-        xf86Msg(X_ERROR, "%s: Couldn't open mtdev device\n", pInfo->name);
-        EvdevCloseDevice(pInfo);
-        return FALSE;
-    }
-
-    return TRUE;
+    return EvdevMTrackInit(pInfo);
 }
 
 static int
@@ -2647,23 +3842,30 @@ EvdevOpenDevice(InputInfoPtr pInfo)
     }
 
     if (libevdev_get_fd(pEvdev->dev) != -1) {
-        struct input_event ev;
-
         libevdev_change_fd(pEvdev->dev, pInfo->fd);
-        /* re-sync libevdev's view of the device, but
-           we don't care about the actual events here */
-        libevdev_next_event(pEvdev->dev, LIBEVDEV_READ_FLAG_FORCE_SYNC, &ev);
-        while (libevdev_next_event(pEvdev->dev, LIBEVDEV_READ_FLAG_SYNC, &ev) == LIBEVDEV_READ_STATUS_SYNC)
-            ;
+        EvdevResync(pInfo, pInfo->dev && pInfo->dev->public.on);
     } else {
         int rc = libevdev_set_fd(pEvdev->dev, pInfo->fd);
         if (rc < 0) {
             xf86IDrvMsg(pInfo, X_ERROR, "Unable to query fd: %s\n", strerror(-rc));
             return BadValue;
         }
+        /* before the probe enables any codes, see EvdevIsSameDevice */
+        if (!EvdevHashCaps(pInfo, &pEvdev->kernel_caps))
+            pEvdev->kernel_caps = 0;
     }
 
-    /* Check major/minor of device node to avoid adding duplicate devices. */
+    /* kernel timestamps on the server's clock, for the latency histogram */
+    pEvdev->latency.monotonic =
+        libevdev_set_clock_id(pEvdev->dev, CLOCK_MONOTONIC) == 0;
+
+    /* absinfo may have changed while the device was closed */
+    EvdevUpdateAbsTransform(pEvdev);
+
+    /* Check major/minor of device node to avoid adding duplicate devices.
+     * The device is already in the set if it was left open after PreInit. */
+    if (pEvdev->min_maj)
+        EvdevRemoveOpenDevice(pEvdev);
     pEvdev->min_maj = EvdevGetMajorMinor(pInfo);
     if (EvdevIsDuplicate(pInfo))
     {
@@ -2671,9 +3873,11 @@ EvdevOpenDevice(InputInfoPtr pInfo)
         EvdevCloseDevice(pInfo);
         return BadMatch;
     }
+    if (pEvdev->min_maj)
+        EvdevAddOpenDevice(pEvdev);
 
-    if (!EvdevOpenMTDev(pInfo)) {
-        xf86Msg(X_ERROR, "%s: Couldn't open mtdev device\n", pInfo->name);
+    if (!EvdevOpenMTrack(pInfo)) {
+        xf86Msg(X_ERROR, "%s: Couldn't allocate contact tracking\n", pInfo->name);
         EvdevCloseDevice(pInfo);
         return BadValue;
     }
@@ -2685,18 +3889,16 @@ static void
 EvdevCloseDevice(InputInfoPtr pInfo)
 {
     EvdevPtr pEvdev = pInfo->private;
+
+    EvdevRemoveOpenDevice(pEvdev);
+
     if (!(pInfo->flags & XI86_SERVER_FD) && pInfo->fd >= 0)
     {
         close(pInfo->fd);
         pInfo->fd = -1;
     }
 
-    if (pEvdev->mtdev)
-    {
-        mtdev_close_delete(pEvdev->mtdev);
-        pEvdev->mtdev = NULL;
-    }
-
+    EvdevMTrackFree(pInfo);
 }
 
 
@@ -2706,6 +3908,9 @@ EvdevUnInit(InputDriverPtr drv, InputInfoPtr pInfo, int flags)
     EvdevPtr pEvdev = pInfo ? pInfo->private : NULL;
     if (pEvdev)
     {
+        /* PreInit leaves the device open, it may not have been closed */
+        EvdevRemoveOpenDevice(pEvdev);
+
         /* Release string allocated in EvdevOpenDevice. */
         free(pEvdev->device);
         pEvdev->device = NULL;
@@ -2713,6 +3918,18 @@ EvdevUnInit(InputDriverPtr drv, InputInfoPtr pInfo, int flags)
         free(pEvdev->type_name);
         pEvdev->type_name = NULL;
 
+        EvdevFreeAuxFilter(pEvdev);
+        EvdevDragLockFree(pInfo);
+        EvdevWheelEmuFree(pInfo);
+
+        TimerFree(pEvdev->reopen_timer);
+        pEvdev->reopen_timer = NULL;
+        TimerFree(pEvdev->leds.timer);
+        pEvdev->leds.timer = NULL;
+        TimerFree(pEvdev->predict.timer);
+        pEvdev->predict.timer = NULL;
+        valuator_mask_free(&pEvdev->predict.mask);
+
         libevdev_free(pEvdev->dev);
     }
     xf86DeleteInput(pInfo, flags);
@@ -2722,10 +3939,12 @@ static EvdevPtr
 EvdevAlloc(InputInfoPtr pInfo)
 {
     int i;
-    EvdevPtr pEvdev = calloc(sizeof(EvdevRec), 1);
+    EvdevPtr pEvdev;
 
-    if (!pEvdev)
+    /* keep the per-frame state at the start of EvdevRec in its own cache lines */
+    if (posix_memalign((void**)&pEvdev, EVDEV_CACHELINE, sizeof(EvdevRec)) != 0)
         return NULL;
+    memset(pEvdev, 0, sizeof(EvdevRec));
 
     pEvdev->dev = libevdev_new();
     if (!pEvdev->dev) {
@@ -2739,9 +3958,18 @@ EvdevAlloc(InputInfoPtr pInfo)
      */
     pEvdev->in_proximity = 1;
     pEvdev->use_proximity = 1;
+    pEvdev->leds.written = -1;
 
     pEvdev->cur_slot = -1;
 
+    pEvdev->smoothScroll.vert_units = 1;
+    pEvdev->smoothScroll.horiz_units = 1;
+
+    pEvdev->pressure.curve[2] = 100;
+    pEvdev->pressure.curve[3] = 100;
+
+    EvdevUpdateRelTransform(pEvdev);
+
     for (i = 0; i < ArrayLength(pEvdev->rel_axis_map); i++)
         pEvdev->rel_axis_map[i] = -1;
     for (i = 0; i < ArrayLength(pEvdev->abs_axis_map); i++)
@@ -2779,6 +4007,14 @@ EvdevPreInit(InputDriverPtr drv, InputInfoPtr pInfo, int flags)
        Note that this needs a server that sets the console to RAW mode. */
     pEvdev->grabDevice = xf86CheckBoolOption(pInfo->options, "GrabDevice", 0);
 
+    pEvdev->reopen_attempts = xf86SetIntOption(pInfo->options, "ReopenAttempts", 10);
+    if (pEvdev->reopen_attempts < 0 || pEvdev->reopen_attempts > 255) {
+        xf86IDrvMsg(pInfo, X_WARNING, "Invalid ReopenAttempts value: %d\n",
+                    pEvdev->reopen_attempts);
+        xf86IDrvMsg(pInfo, X_WARNING, "Using built-in value: 10\n");
+        pEvdev->reopen_attempts = 10;
+    }
+
     /* If grabDevice is set, ungrab immediately since we only want to grab
      * between DEVICE_ON and DEVICE_OFF. If we never get DEVICE_ON, don't
      * hold a grab. */
@@ -2836,6 +4072,10 @@ _X_EXPORT InputDriverRec EVDEV = {
 static void
 EvdevUnplug(pointer	p)
 {
+    EvdevAppleFini();
+
+    udev_unref(evdev_udev);
+    evdev_udev = NULL;
 }
 
 static pointer
@@ -2845,6 +4085,11 @@ EvdevPlug(pointer	module,
           int		*errmin)
 {
     xf86AddInputDriver(&EVDEV, module, 0);
+
+    evdev_udev = udev_new();
+    if (!evdev_udev)
+        xf86Msg(X_WARNING, "evdev: failed to create udev context\n");
+
     return module;
 }
 
@@ -2905,15 +4150,58 @@ EvdevUtilButtonEventToButtonNumber(EvdevPtr pEvdev, int code)
     }
 }
 
+/* The label atoms of axis_labels.h. XIGetKnownProperty looks each name up
+ * in the server's list of known properties, so they are resolved once per
+ * server generation and copied into each device's labels. */
+static struct {
+    unsigned long generation;
+    Atom axis_prop;
+    Atom btn_prop;
+    Atom abs[ArrayLength(abs_labels)];
+    Atom rel[ArrayLength(rel_labels)];
+    Atom btn[ArrayLength(btn_labels)][16];
+    Atom btn_unknown;
+    Atom wheel[4];              /* buttons 4-7 */
+} label_cache;
+
+static void EvdevCacheLabels(void)
+{
+    int i, j;
+
+    if (label_cache.generation == serverGeneration)
+        return;
+
+    label_cache.axis_prop = XIGetKnownProperty(AXIS_LABEL_PROP);
+    label_cache.btn_prop = XIGetKnownProperty(BTN_LABEL_PROP);
+
+    for (i = 0; i < ArrayLength(abs_labels); i++)
+        label_cache.abs[i] = XIGetKnownProperty(abs_labels[i]);
+    for (i = 0; i < ArrayLength(rel_labels); i++)
+        label_cache.rel[i] = XIGetKnownProperty(rel_labels[i]);
+
+    for (i = 0; i < ArrayLength(btn_labels); i++)
+        for (j = 0; j < 16; j++)
+            label_cache.btn[i][j] = btn_labels[i][j] ?
+                                    XIGetKnownProperty(btn_labels[i][j]) : None;
+
+    label_cache.btn_unknown = XIGetKnownProperty(BTN_LABEL_PROP_BTN_UNKNOWN);
+    label_cache.wheel[0] = XIGetKnownProperty(BTN_LABEL_PROP_BTN_WHEEL_UP);
+    label_cache.wheel[1] = XIGetKnownProperty(BTN_LABEL_PROP_BTN_WHEEL_DOWN);
+    label_cache.wheel[2] = XIGetKnownProperty(BTN_LABEL_PROP_BTN_HWHEEL_LEFT);
+    label_cache.wheel[3] = XIGetKnownProperty(BTN_LABEL_PROP_BTN_HWHEEL_RIGHT);
+
+    label_cache.generation = serverGeneration;
+}
+
 static void EvdevInitOneAxisLabel(EvdevPtr pEvdev, int mapped_axis,
-                                  const char **labels, int label_idx, Atom *atoms)
+                                  const Atom *labels, int label_idx, Atom *atoms)
 {
     Atom atom;
 
     if (mapped_axis == -1)
         return;
 
-    atom = XIGetKnownProperty(labels[label_idx]);
+    atom = labels[label_idx];
     if (!atom) /* Should not happen */
         return;
 
@@ -2924,15 +4212,16 @@ static void EvdevInitAxesLabels(EvdevPtr pEvdev, int mode, int natoms, Atom *ato
 {
     int axis;
 
+    EvdevCacheLabels();
     memset(atoms, 0, natoms * sizeof(Atom));
 
     /* rel[0] and [1] are always mapped, so we get the rel labels. if we
        have abs x/y, the labels will be overwritten with the right one */
     for (axis = 0; axis < ArrayLength(rel_labels); axis++)
-        EvdevInitOneAxisLabel(pEvdev, pEvdev->rel_axis_map[axis], rel_labels, axis, atoms);
+        EvdevInitOneAxisLabel(pEvdev, pEvdev->rel_axis_map[axis], label_cache.rel, axis, atoms);
 
     for (axis = 0; axis < ArrayLength(abs_labels); axis++)
-        EvdevInitOneAxisLabel(pEvdev, pEvdev->abs_axis_map[axis], abs_labels, axis, atoms);
+        EvdevInitOneAxisLabel(pEvdev, pEvdev->abs_axis_map[axis], label_cache.abs, axis, atoms);
 }
 
 static void EvdevInitButtonLabels(EvdevPtr pEvdev, int natoms, Atom *atoms)
@@ -2940,10 +4229,11 @@ static void EvdevInitButtonLabels(EvdevPtr pEvdev, int natoms, Atom *atoms)
     Atom atom;
     int button, bmap;
 
+    EvdevCacheLabels();
+
     /* First, make sure all atoms are initialized */
-    atom = XIGetKnownProperty(BTN_LABEL_PROP_BTN_UNKNOWN);
     for (button = 0; button < natoms; button++)
-        atoms[button] = atom;
+        atoms[button] = label_cache.btn_unknown;
 
     for (button = BTN_MISC; button < BTN_JOYSTICK; button++)
     {
@@ -2956,10 +4246,7 @@ static void EvdevInitButtonLabels(EvdevPtr pEvdev, int natoms, Atom *atoms)
         if (!libevdev_has_event_code(pEvdev->dev, EV_KEY, button))
             continue;
 
-        if (!btn_labels[group][idx])
-            continue;
-
-        atom = XIGetKnownProperty(btn_labels[group][idx]);
+        atom = label_cache.btn[group][idx];
         if (!atom)
             continue;
 
@@ -2969,40 +4256,462 @@ static void EvdevInitButtonLabels(EvdevPtr pEvdev, int natoms, Atom *atoms)
     }
 
     /* wheel buttons, hardcoded anyway */
-    if (natoms > 3)
-        atoms[3] = XIGetKnownProperty(BTN_LABEL_PROP_BTN_WHEEL_UP);
-    if (natoms > 4)
-        atoms[4] = XIGetKnownProperty(BTN_LABEL_PROP_BTN_WHEEL_DOWN);
-    if (natoms > 5)
-        atoms[5] = XIGetKnownProperty(BTN_LABEL_PROP_BTN_HWHEEL_LEFT);
-    if (natoms > 6)
-        atoms[6] = XIGetKnownProperty(BTN_LABEL_PROP_BTN_HWHEEL_RIGHT);
+    for (button = 3; button < natoms && button < 7; button++)
+        atoms[button] = label_cache.wheel[button - 3];
 }
 
-static void
-EvdevInitProperty(DeviceIntPtr dev)
+static int
+EvdevSetReopenProperty(DeviceIntPtr dev, XIPropertyValuePtr val, BOOL checkonly)
 {
     InputInfoPtr pInfo  = dev->public.devicePrivate;
     EvdevPtr     pEvdev = pInfo->private;
-    int          rc;
-    char         *device_node;
 
-    CARD32       product[2];
+    if (!checkonly)
+        pEvdev->reopen_attempts = *((CARD8*)val->data);
 
-    prop_product_id = MakeAtom(XI_PROP_PRODUCT_ID, strlen(XI_PROP_PRODUCT_ID), TRUE);
-    product[0] = libevdev_get_id_vendor(pEvdev->dev);
-    product[1] = libevdev_get_id_product(pEvdev->dev);
-    rc = XIChangeDeviceProperty(dev, prop_product_id, XA_INTEGER, 32,
-                                PropModeReplace, 2, product, FALSE);
-    if (rc != Success)
-        return;
+    return Success;
+}
 
-    XISetDevicePropertyDeletable(dev, prop_product_id, FALSE);
+static int
+EvdevSetInvertProperty(DeviceIntPtr dev, XIPropertyValuePtr val, BOOL checkonly)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
+
+    if (!checkonly)
+    {
+        BOOL *data = (BOOL*)val->data;
+        pEvdev->invert_x = data[0];
+        pEvdev->invert_y = data[1];
+        EvdevUpdateAbsTransform(pEvdev);
+        EvdevUpdateRelTransform(pEvdev);
+    }
+
+    return Success;
+}
+
+static int
+EvdevSetCalibrationProperty(DeviceIntPtr dev, XIPropertyValuePtr val,
+                            BOOL checkonly)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+
+    if (val->size != 4 && val->size != 0)
+        return BadMatch;
+
+    if (!checkonly)
+        EvdevSetCalibration(pInfo, val->size, val->data);
+
+    return Success;
+}
+
+static int
+EvdevSetSwapProperty(DeviceIntPtr dev, XIPropertyValuePtr val, BOOL checkonly)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
+
+    if (!checkonly) {
+        pEvdev->swap_axes = *((BOOL*)val->data);
+        EvdevUpdateAbsTransform(pEvdev);
+        EvdevUpdateRelTransform(pEvdev);
+    }
+
+    return Success;
+}
+
+static int
+EvdevSetScrollDistProperty(DeviceIntPtr dev, XIPropertyValuePtr val,
+                           BOOL checkonly)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
+
+    if (!checkonly) {
+        int *data = (int *)val->data;
+        pEvdev->smoothScroll.vert_delta = data[0];
+        pEvdev->smoothScroll.horiz_delta = data[1];
+        pEvdev->smoothScroll.dial_delta = data[2];
+        EvdevSetScrollValuators(dev);
+    }
+
+    return Success;
+}
+
+static int
+EvdevSetHysteresisProperty(DeviceIntPtr dev, XIPropertyValuePtr val,
+                           BOOL checkonly)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
+    int *data = (int *)val->data;
+
+    if (!checkonly) {
+        pEvdev->hysteresis.threshold[0] = data[0];
+        pEvdev->hysteresis.threshold[1] = data[1];
+    }
+
+    return Success;
+}
+
+static int
+EvdevSetAuxFilterProperty(DeviceIntPtr dev, XIPropertyValuePtr val,
+                          BOOL checkonly)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
+    int *data = (int *)val->data;
+
+    if (!checkonly) {
+        if ((data[0] || data[1] || data[2]) && !EvdevAllocAuxFilter(pEvdev))
+            return BadAlloc;
+
+        pEvdev->aux.deadzone = data[0];
+        pEvdev->aux.min_change = data[1];
+        pEvdev->aux.max_rate = data[2];
+    }
+
+    return Success;
+}
+
+static int
+EvdevSetPressureCurveProperty(DeviceIntPtr dev, XIPropertyValuePtr val,
+                              BOOL checkonly)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
+
+    if (!checkonly && !EvdevUpdatePressureCurve(pEvdev, (int *)val->data))
+        return BadAlloc;
+
+    return Success;
+}
+
+static int
+EvdevSetPalmProperty(DeviceIntPtr dev, XIPropertyValuePtr val, BOOL checkonly)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
+    int *data = (int *)val->data;
+
+    if (!checkonly) {
+        pEvdev->palm.touch_major = data[0];
+        pEvdev->palm.pressure = data[1];
+        pEvdev->palm.max_touches = data[2];
+    }
+
+    return Success;
+}
+
+/* the counters are updated on read, clients may write zeros to reset them */
+static int
+EvdevSetPalmRejectedProperty(DeviceIntPtr dev, XIPropertyValuePtr val,
+                             BOOL checkonly)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
+    CARD32 *data = (CARD32 *)val->data;
+    int i;
+
+    for (i = 0; i < 3; i++)
+        if (data[i] != 0)
+            return BadValue;
+
+    if (!checkonly)
+        memset(pEvdev->palm.rejected, 0, sizeof(pEvdev->palm.rejected));
+
+    return Success;
+}
+
+static int
+EvdevGetPalmRejectedProperty(DeviceIntPtr dev)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
+    uint32_t rejected[3];
+
+    memcpy(rejected, pEvdev->palm.rejected, sizeof(rejected));
+    XIChangeDeviceProperty(dev, prop_palm_rejected, XA_CARDINAL, 32,
+                           PropModeReplace, 3, rejected, FALSE);
+
+    return Success;
+}
+
+/* the histogram is updated on read, clients may write zeros to reset it */
+static int
+EvdevSetLatencyProperty(DeviceIntPtr dev, XIPropertyValuePtr val,
+                        BOOL checkonly)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
+    CARD32 *data = (CARD32 *)val->data;
+    int i;
+
+    for (i = 0; i < EVDEV_LATENCY_BUCKETS; i++)
+        if (data[i] != 0)
+            return BadValue;
+
+    if (!checkonly)
+        memset(pEvdev->latency.hist, 0, sizeof(pEvdev->latency.hist));
+
+    return Success;
+}
+
+static int
+EvdevGetLatencyProperty(DeviceIntPtr dev)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
+    uint32_t hist[EVDEV_LATENCY_BUCKETS];
+
+    memcpy(hist, pEvdev->latency.hist, sizeof(hist));
+    XIChangeDeviceProperty(dev, prop_latency, XA_CARDINAL, 32,
+                           PropModeReplace, EVDEV_LATENCY_BUCKETS, hist, FALSE);
+
+    return Success;
+}
+
+/* type, format, min/max size, min/max value, set, get */
+static const EvdevPropDesc readonly_desc =
+    { None, 0, 0, 0, 0, 0, NULL, NULL };
+static const EvdevPropDesc reopen_desc =
+    { XA_INTEGER, 8, 1, 1, 0, 0, EvdevSetReopenProperty, NULL };
+static const EvdevPropDesc invert_desc =
+    { XA_INTEGER, 8, 2, 2, 0, 0, EvdevSetInvertProperty, NULL };
+static const EvdevPropDesc calibration_desc =
+    { XA_INTEGER, 32, 0, 4, 0, 0, EvdevSetCalibrationProperty, NULL };
+static const EvdevPropDesc swap_desc =
+    { XA_INTEGER, 8, 1, 1, 0, 0, EvdevSetSwapProperty, NULL };
+static const EvdevPropDesc scroll_dist_desc =
+    { XA_INTEGER, 32, 3, 3, 0, 0, EvdevSetScrollDistProperty, NULL };
+static const EvdevPropDesc hysteresis_desc =
+    { XA_INTEGER, 32, 2, 2, 0, INT_MAX, EvdevSetHysteresisProperty, NULL };
+static const EvdevPropDesc aux_filter_desc =
+    { XA_INTEGER, 32, 3, 3, 0, INT_MAX, EvdevSetAuxFilterProperty, NULL };
+static const EvdevPropDesc pressure_curve_desc =
+    { XA_INTEGER, 32, 4, 4, 0, 100, EvdevSetPressureCurveProperty, NULL };
+static const EvdevPropDesc palm_desc =
+    { XA_INTEGER, 32, 3, 3, 0, INT_MAX, EvdevSetPalmProperty, NULL };
+static const EvdevPropDesc palm_rejected_desc =
+    { XA_CARDINAL, 32, 3, 3, 0, 0, EvdevSetPalmRejectedProperty,
+      EvdevGetPalmRejectedProperty };
+static const EvdevPropDesc latency_desc =
+    { XA_CARDINAL, 32, EVDEV_LATENCY_BUCKETS, EVDEV_LATENCY_BUCKETS, 0, 0,
+      EvdevSetLatencyProperty, EvdevGetLatencyProperty };
+
+/* The properties of all modules by atom, one handler serves them all.
+ * Open addressing, the table is kept at most half full. Each property
+ * gets an index in the order it is first registered, each device has a
+ * bit per index in pEvdev->props for the properties it created. */
+#define PROP_MAX        64 /* bits in pEvdev->props */
+#define PROP_TABLE_SIZE (2 * PROP_MAX)
+
+static struct {
+    Atom atom;
+    const EvdevPropDesc *desc;
+    int index;
+} prop_table[PROP_TABLE_SIZE];
+static int prop_count;
+static unsigned long prop_generation;
+
+/**
+ * Make the property handler accept the given property as described on
+ * this device. Called for every device that has the property, the
+ * description is shared, registering again is harmless.
+ */
+void
+EvdevRegisterProperty(DeviceIntPtr dev, Atom atom, const EvdevPropDesc *desc)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
+    unsigned int i, n;
+
+    /* atoms don't survive a server reset */
+    if (prop_generation != serverGeneration) {
+        memset(prop_table, 0, sizeof(prop_table));
+        prop_count = 0;
+        prop_generation = serverGeneration;
+    }
+
+    if (atom == None)
+        return;
+
+    for (i = atom % PROP_TABLE_SIZE, n = 0; n < PROP_TABLE_SIZE;
+         i = (i + 1) % PROP_TABLE_SIZE, n++) {
+        if (prop_table[i].atom == atom) {
+            prop_table[i].desc = desc;
+            break;
+        }
+        if (prop_table[i].atom == None) {
+            if (prop_count == PROP_MAX)
+                break;
+            prop_table[i].atom = atom;
+            prop_table[i].desc = desc;
+            prop_table[i].index = prop_count++;
+            break;
+        }
+    }
+
+    if (prop_table[i].atom != atom) {
+        xf86Msg(X_ERROR, "evdev: BUG: property table full, property %s ignored\n",
+                NameForAtom(atom));
+        return;
+    }
+
+    pEvdev->props |= 1ULL << prop_table[i].index;
+}
+
+/* The property atoms of all modules. MakeAtom hashes the name, so each
+ * atom is made once per server generation rather than once per device. */
+#define ATOM_CACHE_SIZE 48
+
+static Atom *atom_cache[ATOM_CACHE_SIZE];
+static int atom_cache_count;
+static unsigned long atom_generation;
+
+/**
+ * Set *atom to the atom for name, unless it already is. atom must be a
+ * static variable, it is reset when the server generation changes.
+ *
+ * @return the atom
+ */
+Atom
+EvdevInternAtom(Atom *atom, const char *name)
+{
+    int i;
+
+    if (atom_generation != serverGeneration) {
+        for (i = 0; i < atom_cache_count; i++)
+            *atom_cache[i] = None;
+        atom_generation = serverGeneration;
+    }
+
+    if (*atom != None)
+        return *atom;
+
+    *atom = MakeAtom(name, strlen(name), TRUE);
+
+    for (i = 0; i < atom_cache_count; i++)
+        if (atom_cache[i] == atom)
+            return *atom;
+
+    if (atom_cache_count < ATOM_CACHE_SIZE)
+        atom_cache[atom_cache_count++] = atom;
+    else
+        xf86Msg(X_ERROR, "evdev: BUG: atom cache full, %s not cached\n", name);
+
+    return *atom;
+}
+
+/**
+ * @return the description of the property, or NULL if dev doesn't have it
+ */
+static const EvdevPropDesc *
+EvdevLookupProperty(DeviceIntPtr dev, Atom atom)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
+    unsigned int i, n;
+
+    for (i = atom % PROP_TABLE_SIZE, n = 0;
+         n < PROP_TABLE_SIZE && prop_table[i].atom != None;
+         i = (i + 1) % PROP_TABLE_SIZE, n++)
+        if (prop_table[i].atom == atom)
+            return (pEvdev->props & (1ULL << prop_table[i].index)) ?
+                   prop_table[i].desc : NULL;
+
+    return NULL;
+}
+
+static int
+EvdevCheckPropertyValue(const EvdevPropDesc *desc, XIPropertyValuePtr val)
+{
+    int i;
+
+    if (val->type != desc->type || val->format != desc->format ||
+        val->size < desc->min_size || val->size > desc->max_size)
+        return BadMatch;
+
+    if (desc->min_value >= desc->max_value)
+        return Success;
+
+    for (i = 0; i < val->size; i++) {
+        long v;
+
+        switch (val->format) {
+            case 8:  v = ((CARD8*)val->data)[i];  break;
+            case 16: v = ((CARD16*)val->data)[i]; break;
+            default: v = ((INT32*)val->data)[i];  break;
+        }
+
+        if (v < desc->min_value || v > desc->max_value)
+            return BadValue;
+    }
+
+    return Success;
+}
+
+static int
+EvdevSetProperty(DeviceIntPtr dev, Atom atom, XIPropertyValuePtr val,
+                 BOOL checkonly)
+{
+    const EvdevPropDesc *desc = EvdevLookupProperty(dev, atom);
+    int rc;
+
+    if (!desc)
+        return Success; /* not ours */
+
+    if (!desc->set)
+        return BadAccess; /* Read-only properties */
+
+    rc = EvdevCheckPropertyValue(desc, val);
+    if (rc != Success)
+        return rc;
+
+    return desc->set(dev, val, checkonly);
+}
+
+/**
+ * Called when a client reads a property. Some properties, e.g. the
+ * rejection counters and the latency histogram, change without going
+ * through the property and are refreshed here.
+ */
+static int
+EvdevGetProperty(DeviceIntPtr dev, Atom atom)
+{
+    const EvdevPropDesc *desc = EvdevLookupProperty(dev, atom);
+
+    if (!desc || !desc->get)
+        return Success;
+
+    return desc->get(dev);
+}
+
+static void
+EvdevInitProperty(DeviceIntPtr dev)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
+    int          rc;
+    char         *device_node;
+
+    CARD32       product[2];
+
+    EvdevInternAtom(&prop_product_id, XI_PROP_PRODUCT_ID);
+    EvdevRegisterProperty(dev, prop_product_id, &readonly_desc);
+    product[0] = libevdev_get_id_vendor(pEvdev->dev);
+    product[1] = libevdev_get_id_product(pEvdev->dev);
+    rc = XIChangeDeviceProperty(dev, prop_product_id, XA_INTEGER, 32,
+                                PropModeReplace, 2, product, FALSE);
+    if (rc != Success)
+        return;
+
+    XISetDevicePropertyDeletable(dev, prop_product_id, FALSE);
 
     /* Device node property */
     device_node = strdup(pEvdev->device);
-    prop_device = MakeAtom(XI_PROP_DEVICE_NODE,
-                           strlen(XI_PROP_DEVICE_NODE), TRUE);
+    EvdevInternAtom(&prop_device, XI_PROP_DEVICE_NODE);
+    EvdevRegisterProperty(dev, prop_device, &readonly_desc);
     rc = XIChangeDeviceProperty(dev, prop_device, XA_STRING, 8,
                                 PropModeReplace,
                                 strlen(device_node), device_node,
@@ -3012,11 +4721,11 @@ EvdevInitProperty(DeviceIntPtr dev)
     if (rc != Success)
         return;
 
-    if (EvdevDeviceIsVirtual(pEvdev->device))
+    if (EvdevDeviceIsVirtual(pEvdev->min_maj))
     {
         BOOL virtual = 1;
-        prop_virtual = MakeAtom(XI_PROP_VIRTUAL_DEVICE,
-                                strlen(XI_PROP_VIRTUAL_DEVICE), TRUE);
+        EvdevInternAtom(&prop_virtual, XI_PROP_VIRTUAL_DEVICE);
+        EvdevRegisterProperty(dev, prop_virtual, &readonly_desc);
         rc = XIChangeDeviceProperty(dev, prop_virtual, XA_INTEGER, 8,
                                     PropModeReplace, 1, &virtual, FALSE);
         if (rc != Success)
@@ -3028,13 +4737,28 @@ EvdevInitProperty(DeviceIntPtr dev)
 
     XISetDevicePropertyDeletable(dev, prop_device, FALSE);
 
+    if (!(pInfo->flags & XI86_SERVER_FD))
+    {
+        CARD8 reopen = pEvdev->reopen_attempts;
+
+        EvdevInternAtom(&prop_reopen, EVDEV_PROP_REOPEN);
+        EvdevRegisterProperty(dev, prop_reopen, &reopen_desc);
+        rc = XIChangeDeviceProperty(dev, prop_reopen, XA_INTEGER, 8,
+                                    PropModeReplace, 1, &reopen, FALSE);
+        if (rc != Success)
+            return;
+
+        XISetDevicePropertyDeletable(dev, prop_reopen, FALSE);
+    }
+
     if (pEvdev->flags & (EVDEV_RELATIVE_EVENTS | EVDEV_ABSOLUTE_EVENTS))
     {
         BOOL invert[2];
         invert[0] = pEvdev->invert_x;
         invert[1] = pEvdev->invert_y;
 
-        prop_invert = MakeAtom(EVDEV_PROP_INVERT_AXES, strlen(EVDEV_PROP_INVERT_AXES), TRUE);
+        EvdevInternAtom(&prop_invert, EVDEV_PROP_INVERT_AXES);
+        EvdevRegisterProperty(dev, prop_invert, &invert_desc);
 
         rc = XIChangeDeviceProperty(dev, prop_invert, XA_INTEGER, 8,
                 PropModeReplace, 2,
@@ -3044,8 +4768,8 @@ EvdevInitProperty(DeviceIntPtr dev)
 
         XISetDevicePropertyDeletable(dev, prop_invert, FALSE);
 
-        prop_calibration = MakeAtom(EVDEV_PROP_CALIBRATION,
-                strlen(EVDEV_PROP_CALIBRATION), TRUE);
+        EvdevInternAtom(&prop_calibration, EVDEV_PROP_CALIBRATION);
+        EvdevRegisterProperty(dev, prop_calibration, &calibration_desc);
         if (pEvdev->flags & EVDEV_CALIBRATED) {
             int calibration[4];
 
@@ -3067,8 +4791,8 @@ EvdevInitProperty(DeviceIntPtr dev)
 
         XISetDevicePropertyDeletable(dev, prop_calibration, FALSE);
 
-        prop_swap = MakeAtom(EVDEV_PROP_SWAP_AXES,
-                strlen(EVDEV_PROP_SWAP_AXES), TRUE);
+        EvdevInternAtom(&prop_swap, EVDEV_PROP_SWAP_AXES);
+        EvdevRegisterProperty(dev, prop_swap, &swap_desc);
 
         rc = XIChangeDeviceProperty(dev, prop_swap, XA_INTEGER, 8,
                 PropModeReplace, 1, &pEvdev->swap_axes, FALSE);
@@ -3077,8 +4801,54 @@ EvdevInitProperty(DeviceIntPtr dev)
 
         XISetDevicePropertyDeletable(dev, prop_swap, FALSE);
 
+        if (pEvdev->flags & EVDEV_ABSOLUTE_EVENTS)
+        {
+            EvdevInternAtom(&prop_hysteresis, EVDEV_PROP_HYSTERESIS);
+            EvdevRegisterProperty(dev, prop_hysteresis, &hysteresis_desc);
+            rc = XIChangeDeviceProperty(dev, prop_hysteresis, XA_INTEGER, 32,
+                                        PropModeReplace, 2,
+                                        pEvdev->hysteresis.threshold, FALSE);
+            if (rc != Success)
+                return;
+
+            XISetDevicePropertyDeletable(dev, prop_hysteresis, FALSE);
+        }
+
+        if ((pEvdev->flags & EVDEV_ABSOLUTE_EVENTS) && pEvdev->num_vals > 2)
+        {
+            int aux[3] = {
+                pEvdev->aux.deadzone,
+                pEvdev->aux.min_change,
+                pEvdev->aux.max_rate
+            };
+
+            EvdevInternAtom(&prop_aux_filter, EVDEV_PROP_AUX_FILTER);
+            EvdevRegisterProperty(dev, prop_aux_filter, &aux_filter_desc);
+            rc = XIChangeDeviceProperty(dev, prop_aux_filter, XA_INTEGER, 32,
+                                        PropModeReplace, 3, aux, FALSE);
+            if (rc != Success)
+                return;
+
+            XISetDevicePropertyDeletable(dev, prop_aux_filter, FALSE);
+        }
+
+        if (pEvdev->abs_axis_map[ABS_PRESSURE] >= 0 ||
+            pEvdev->abs_axis_map[ABS_MT_PRESSURE] >= 0)
+        {
+            EvdevInternAtom(&prop_pressure_curve, EVDEV_PROP_PRESSURE_CURVE);
+            EvdevRegisterProperty(dev, prop_pressure_curve, &pressure_curve_desc);
+            rc = XIChangeDeviceProperty(dev, prop_pressure_curve, XA_INTEGER, 32,
+                                        PropModeReplace, 4,
+                                        pEvdev->pressure.curve, FALSE);
+            if (rc != Success)
+                return;
+
+            XISetDevicePropertyDeletable(dev, prop_pressure_curve, FALSE);
+        }
+
         /* Axis labelling */
-        if ((pEvdev->num_vals > 0) && (prop_axis_label = XIGetKnownProperty(AXIS_LABEL_PROP)))
+        EvdevCacheLabels();
+        if ((pEvdev->num_vals > 0) && (prop_axis_label = label_cache.axis_prop))
         {
             int mode;
             int num_axes = pEvdev->num_vals + pEvdev->num_mt_vals;
@@ -3094,6 +4864,7 @@ EvdevInitProperty(DeviceIntPtr dev)
             }
 
             EvdevInitAxesLabels(pEvdev, mode, num_axes, atoms);
+            EvdevRegisterProperty(dev, prop_axis_label, &readonly_desc);
             rc = XIChangeDeviceProperty(dev, prop_axis_label, XA_ATOM, 32,
                                         PropModeReplace, num_axes, atoms, FALSE);
             if (rc != Success)
@@ -3102,10 +4873,11 @@ EvdevInitProperty(DeviceIntPtr dev)
             XISetDevicePropertyDeletable(dev, prop_axis_label, FALSE);
         }
         /* Button labelling */
-        if ((pEvdev->num_buttons > 0) && (prop_btn_label = XIGetKnownProperty(BTN_LABEL_PROP)))
+        if ((pEvdev->num_buttons > 0) && (prop_btn_label = label_cache.btn_prop))
         {
             Atom atoms[EVDEV_MAXBUTTONS];
             EvdevInitButtonLabels(pEvdev, EVDEV_MAXBUTTONS, atoms);
+            EvdevRegisterProperty(dev, prop_btn_label, &readonly_desc);
             rc = XIChangeDeviceProperty(dev, prop_btn_label, XA_ATOM, 32,
                                         PropModeReplace, pEvdev->num_buttons, atoms, FALSE);
             if (rc != Success)
@@ -3120,8 +4892,8 @@ EvdevInitProperty(DeviceIntPtr dev)
                 pEvdev->smoothScroll.horiz_delta,
                 pEvdev->smoothScroll.dial_delta
             };
-            prop_scroll_dist = MakeAtom(EVDEV_PROP_SCROLL_DISTANCE,
-                                        strlen(EVDEV_PROP_SCROLL_DISTANCE), TRUE);
+            EvdevInternAtom(&prop_scroll_dist, EVDEV_PROP_SCROLL_DISTANCE);
+            EvdevRegisterProperty(dev, prop_scroll_dist, &scroll_dist_desc);
             rc = XIChangeDeviceProperty(dev, prop_scroll_dist, XA_INTEGER, 32,
                                         PropModeReplace, 3, smooth_scroll_values, FALSE);
             if (rc != Success)
@@ -3130,61 +4902,42 @@ EvdevInitProperty(DeviceIntPtr dev)
             XISetDevicePropertyDeletable(dev, prop_scroll_dist, FALSE);
         }
 
-    }
+        if (pEvdev->mt_mask)
+        {
+            int palm[3] = {
+                pEvdev->palm.touch_major,
+                pEvdev->palm.pressure,
+                pEvdev->palm.max_touches
+            };
 
-}
+            EvdevInternAtom(&prop_palm, EVDEV_PROP_PALM);
+            EvdevRegisterProperty(dev, prop_palm, &palm_desc);
+            rc = XIChangeDeviceProperty(dev, prop_palm, XA_INTEGER, 32,
+                                        PropModeReplace, 3, palm, FALSE);
+            if (rc != Success)
+                return;
 
-static int
-EvdevSetProperty(DeviceIntPtr dev, Atom atom, XIPropertyValuePtr val,
-                 BOOL checkonly)
-{
-    InputInfoPtr pInfo  = dev->public.devicePrivate;
-    EvdevPtr     pEvdev = pInfo->private;
+            XISetDevicePropertyDeletable(dev, prop_palm, FALSE);
 
-    if (atom == prop_invert)
-    {
-        BOOL* data;
-        if (val->format != 8 || val->size != 2 || val->type != XA_INTEGER)
-            return BadMatch;
+            EvdevInternAtom(&prop_palm_rejected, EVDEV_PROP_PALM_REJECTED);
+            EvdevRegisterProperty(dev, prop_palm_rejected, &palm_rejected_desc);
+            rc = XIChangeDeviceProperty(dev, prop_palm_rejected, XA_CARDINAL, 32,
+                                        PropModeReplace, 3, pEvdev->palm.rejected,
+                                        FALSE);
+            if (rc != Success)
+                return;
 
-        if (!checkonly)
-        {
-            data = (BOOL*)val->data;
-            pEvdev->invert_x = data[0];
-            pEvdev->invert_y = data[1];
+            XISetDevicePropertyDeletable(dev, prop_palm_rejected, FALSE);
         }
-    } else if (atom == prop_calibration)
-    {
-        if (val->format != 32 || val->type != XA_INTEGER)
-            return BadMatch;
-        if (val->size != 4 && val->size != 0)
-            return BadMatch;
-
-        if (!checkonly)
-            EvdevSetCalibration(pInfo, val->size, val->data);
-    } else if (atom == prop_swap)
-    {
-        if (val->format != 8 || val->type != XA_INTEGER || val->size != 1)
-            return BadMatch;
+    }
 
-        if (!checkonly)
-            pEvdev->swap_axes = *((BOOL*)val->data);
-    } else if (atom == prop_scroll_dist)
-    {
-        if (val->format != 32 || val->type != XA_INTEGER || val->size != 3)
-            return BadMatch;
-
-        if (!checkonly) {
-            int *data = (int *)val->data;
-            pEvdev->smoothScroll.vert_delta = data[0];
-            pEvdev->smoothScroll.horiz_delta = data[1];
-            pEvdev->smoothScroll.dial_delta = data[2];
-            EvdevSetScrollValuators(dev);
-        }
-    } else if (atom == prop_axis_label || atom == prop_btn_label ||
-               atom == prop_product_id || atom == prop_device ||
-               atom == prop_virtual)
-        return BadAccess; /* Read-only properties */
+    EvdevInternAtom(&prop_latency, EVDEV_PROP_LATENCY);
+    EvdevRegisterProperty(dev, prop_latency, &latency_desc);
+    rc = XIChangeDeviceProperty(dev, prop_latency, XA_CARDINAL, 32,
+                                PropModeReplace, EVDEV_LATENCY_BUCKETS,
+                                pEvdev->latency.hist, FALSE);
+    if (rc != Success)
+        return;
 
-    return Success;
+    XISetDevicePropertyDeletable(dev, prop_latency, FALSE);
 }
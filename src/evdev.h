@@ -43,8 +43,6 @@
 #include <xf86_OSproc.h>
 #include <xkbstr.h>
 
-#include <mtdev.h>
-
 #include <libevdev/libevdev.h>
 
 #ifndef EV_CNT /* linux 2.6.23 kernels and earlier lack _CNT defines */
@@ -63,6 +61,13 @@
 #define LED_CNT (LED_MAX+1)
 #endif
 
+#ifndef REL_WHEEL_HI_RES
+#define REL_WHEEL_HI_RES 0x0b
+#endif
+#ifndef REL_HWHEEL_HI_RES
+#define REL_HWHEEL_HI_RES 0x0c
+#endif
+
 #if GET_ABI_MAJOR(ABI_XINPUT_VERSION) < 18
 #define LogMessageVerbSigSafe xf86MsgVerb
 #endif
@@ -81,6 +86,7 @@
 
 #define EVDEV_MAXBUTTONS 32
 #define EVDEV_MAXQUEUE 32
+#define EVDEV_WHEEL_SAMPLES 8 /* motion history for kinetic scrolling */
 
 /* evdev flags */
 #define EVDEV_KEYBOARD_EVENTS	(1 << 0)
@@ -111,6 +117,22 @@
 
 #define DEFAULT_MOUSE_DPI 1000.0
 
+/* REL_WHEEL_HI_RES and REL_HWHEEL_HI_RES units per wheel detent */
+#define HIRES_SCROLL_UNITS 120
+
+/* contacts tracked for multitouch protocol A devices */
+#define EVDEV_MTRACK_MAX_CONTACTS 10
+
+/* alignment of the configuration part of EvdevRec */
+#define EVDEV_CACHELINE 64
+#define EVDEV_CACHELINE_ALIGNED __attribute__((aligned(EVDEV_CACHELINE)))
+
+/* fractional bits of the absolute axis transform */
+#define ABS_TRANSFORM_SHIFT 16
+
+/* latency histogram buckets: 0 ms, then powers of two up to 64+ ms */
+#define EVDEV_LATENCY_BUCKETS 8
+
 /* Function key mode */
 enum fkeymode {
     FKEYMODE_UNKNOWN = 0,
@@ -130,13 +152,37 @@ enum ButtonAction {
     BUTTON_PRESS = 1
 };
 
+/* motion sample for kinetic scrolling */
+typedef struct {
+    Time time;
+    int value;
+} WheelSample;
+
 /* axis specific data for wheel emulation */
 typedef struct {
     int up_button;
     int down_button;
     int traveled_distance;
+    WheelSample *samples;           /* ring buffer of recent motion,
+                                       allocated if kinetic scrolling is on */
+    int cur_sample;                 /* next sample to write */
+    int velocity;                   /* kinetic velocity, 16.16 units/ms */
+    int remainder;                  /* kinetic distance not posted yet, 16.16 */
 } WheelAxis, *WheelAxisPtr;
 
+/* motion predictor state for the pointer or a touch, see predict.c */
+typedef struct {
+    double filtered[2];     /* filtered x/y, device units */
+    double vel[2];          /* device units per ms */
+    CARD32 time;            /* ms, kernel time of the last sample */
+    int samples;            /* 0 after a reset */
+    int measured[2];        /* last sample before extrapolation */
+    BOOL extrapolated;      /* the last sample was posted extrapolated */
+} PredictorRec, *PredictorPtr;
+
+/* ms without samples before a predictor restarts */
+#define EVDEV_PREDICT_MAX_GAP 50
+
 /* Event queue used to defer keyboard/button events until EV_SYN time. */
 typedef struct {
     enum {
@@ -150,44 +196,79 @@ typedef struct {
         unsigned int touch; /* Touch ID */
     } detail;
     int val;	/* State of the key/button/touch; pressed or released. */
-    ValuatorMask *touchMask;
+    uint64_t touchChanged;  /* valuators to post for a touch */
+    int touchX, touchY;     /* transformed touch coordinates */
 } EventQueueRec, *EventQueuePtr;
 
-typedef struct {
+typedef struct _EvdevRec {
+    /* Per-event and per-frame state comes first so that processing a
+     * frame touches as few cache lines as possible, the configuration and
+     * the state of optional features follow from the next cache line. */
     struct libevdev *dev;
-
-    char *device;
-    int grabDevice;         /* grab the event device? */
-
-    int num_vals;           /* number of valuators */
-    int num_mt_vals;        /* number of multitouch valuators */
-    int abs_axis_map[ABS_CNT]; /* Map evdev ABS_* to index */
-    int rel_axis_map[REL_CNT]; /* Map evdev REL_* to index */
+    int flags;
+    unsigned int abs_queued, rel_queued, prox_queued;
+    int num_queue;              /* entries used in queue */
+    int in_proximity;           /* device in proximity */
+    int use_proximity;          /* using the proximity bit? */
+    int cur_slot;
+    BOOL fake_mt;
+    BOOL rel_pending;           /* motion-only frames merged into rel_vals */
+    CARD32 rel_pending_time;
     ValuatorMask *abs_vals;     /* values for absolute axis */
     ValuatorMask *rel_vals;     /* values for relative axis */
     ValuatorMask *old_vals; /* old absolute values for calculating relative motion */
     ValuatorMask *prox;     /* last absolute values set while not in proximity */
     ValuatorMask *mt_mask;
-    ValuatorMask **last_mt_vals;
-    int cur_slot;
-    struct slot {
-        int dirty;
-        enum SlotState state;
-    } *slots;
-    struct mtdev *mtdev;
-    BOOL fake_mt;
+    struct mtrack *mtrack;  /* protocol A contact tracking */
+    int8_t abs_axis_map[ABS_CNT]; /* Map evdev ABS_* to index, -1 if unused */
+    int8_t rel_axis_map[REL_CNT]; /* Map evdev REL_* to index, -1 if unused */
+    /* swap, calibration and inversion of x/y, see EvdevUpdateAbsTransform.
+       out[i] = clamp(clamp(in[src[i]]) * scale[i] + offset[i]) */
+    struct {
+        int                 src[2];      /* input axis for each output axis */
+        int64_t             scale[2];    /* ABS_TRANSFORM_SHIFT fixed-point */
+        int64_t             offset[2];
+        int                 in_min[2], in_max[2];
+        int                 out_min[2], out_max[2];
+    } abs_transform;
+    /* swap, inversion and resolution scaling of relative x/y, see
+       EvdevUpdateRelTransform. out[i] = in[src[i]] * scale[i] */
+    struct {
+        int                 src[2];      /* input axis for each output axis */
+        double              scale[2];
+        double              remainder[2]; /* fraction not posted yet */
+    } rel_transform;
+    /* per-slot multitouch state, all pointing into mt_slab */
+    void *mt_slab;
+    size_t mt_slab_size;
+    int nslots;
+    uint64_t *slot_changed;     /* valuators changed in this frame, per slot */
+    uint64_t *slot_vals_set;    /* valuators with a value, per slot */
+    PredictorRec *slot_predict;
+    int32_t *slot_vals;         /* MAX_VALUATORS values per slot */
+    unsigned long *dirty_slots; /* bitmap of slots changed in this frame */
+    int32_t *slot_pressure;     /* ABS_MT_PRESSURE before the curve */
+    uint8_t *slot_state;        /* enum SlotState, one byte per slot */
+    /* x/y of the touches in the current frame, one array per coordinate */
+    struct {
+        int *slot;
+        int *x;
+        int *y;
+        int *tx;            /* transformed */
+        int *ty;
+    } mt_frame;
+
+    char *device EVDEV_CACHELINE_ALIGNED;
+    int grabDevice;         /* grab the event device? */
 
-    int flags;
-    int in_proximity;           /* device in proximity */
-    int use_proximity;          /* using the proximity bit? */
+    int num_vals;           /* number of valuators */
+    int num_mt_vals;        /* number of multitouch valuators */
     int num_buttons;            /* number of buttons */
     BOOL swap_axes;
     BOOL invert_x;
     BOOL invert_y;
     int resolution;
 
-    unsigned int abs_queued, rel_queued, prox_queued;
-
     /* Middle mouse button emulation */
     struct {
         BOOL                enabled;
@@ -214,23 +295,31 @@ typedef struct {
     struct {
 	int                 meta;           /* meta key to lock any button */
 	BOOL                meta_state;     /* meta_button state */
-	unsigned int        lock_pair[EVDEV_MAXBUTTONS];  /* specify a meta/lock pair */
-	BOOL                lock_state[EVDEV_MAXBUTTONS]; /* state of any locked buttons */
+	/* EVDEV_MAXBUTTONS each, allocated once drag lock is configured */
+	unsigned int        *lock_pair;     /* specify a meta/lock pair */
+	BOOL                *lock_state;    /* state of any locked buttons */
     } dragLock;
     struct {
         BOOL                enabled;
         int                 button;
         int                 button_state;
         int                 inertia;
+        BOOL                smooth;      /* post to scroll valuators */
         WheelAxis           X;
         WheelAxis           Y;
         Time                expires;     /* time of expiry */
         Time                timeout;
+        BOOL                kinetic;     /* keep scrolling after release */
+        int                 friction;    /* 16.16 velocity factor per tick */
+        OsTimerPtr          kinetic_timer;
+        ValuatorMask        *kinetic_vals;
     } emulateWheel;
     struct {
         int                 vert_delta;
         int                 horiz_delta;
         int                 dial_delta;
+        int                 vert_units;  /* valuator units per detent */
+        int                 horiz_units;
     } smoothScroll;
     /* run-time calibration */
     struct {
@@ -239,23 +328,85 @@ typedef struct {
         int                 min_y;
         int                 max_y;
     } calibration;
+    /* x/y hysteresis in device units, 0 disables */
+    struct {
+        int                 threshold[2];
+        int                 center[2];   /* last value passed on */
+        BOOL                valid[2];
+    } hysteresis;
+    /* filtering of absolute axes other than x/y, 0 disables a setting */
+    struct {
+        int                 deadzone;    /* device units around the rest value */
+        int                 min_change;  /* device units */
+        int                 max_rate;    /* Hz */
+        /* MAX_VALUATORS entries, allocated once a setting is enabled */
+        struct aux_axis {
+            int             last;        /* last value passed on */
+            CARD32          time;        /* ms, kernel time */
+            BOOL            valid;
+            BOOL            pending;     /* value held back by max_rate */
+            int             pending_value;
+            CARD32          pending_time;  /* ms, kernel time */
+            CARD32          pending_since; /* ms, server time */
+        } *axes;
+        ValuatorMask        *mask;       /* held back values to post */
+        OsTimerPtr          timer;
+    } aux;
+    /* pressure response curve for ABS_PRESSURE and ABS_MT_PRESSURE */
+    struct {
+        int                 curve[4];    /* Bézier control points x1 y1 x2 y2, 0-100 */
+        int32_t             *lut[2];     /* NULL for a linear curve */
+        int                 min[2];      /* range covered by lut */
+        int                 max[2];
+    } pressure;
+    /* motion prediction */
+    struct {
+        int                 time;        /* ms ahead, 0 disables */
+        PredictorRec        pointer;
+        BOOL                extrapolated; /* in the current frame */
+        OsTimerPtr          timer;       /* posts the measured position */
+        ValuatorMask        *mask;
+    } predict;
+    /* time from the kernel timestamp to processing of each frame */
+    struct {
+        BOOL                monotonic;   /* kernel uses the server's clock */
+        uint32_t            hist[EVDEV_LATENCY_BUCKETS];
+    } latency;
+    /* palm and large contact rejection, 0 disables a threshold */
+    struct {
+        int                 touch_major; /* max ABS_MT_TOUCH_MAJOR */
+        int                 pressure;    /* max ABS_MT_PRESSURE */
+        int                 max_touches; /* max simultaneous touches */
+        int                 active;      /* touches currently sent */
+        uint32_t            rejected[3]; /* by size, pressure, count */
+    } palm;
 
     unsigned char btnmap[32];           /* config-file specified button mapping */
 
+    uint64_t props;      /* properties this device registered, by index */
     int reopen_attempts; /* max attempts to re-open after read failure */
-    int reopen_left;     /* number of attempts left to re-open the device */
+    int reopen_count;    /* attempts made to re-open the device so far */
+    uint32_t kernel_caps; /* code bitmaps hash at the first open */
     OsTimerPtr reopen_timer;
 
+    /* keyboard LEDs, one bit per entry of led_bits in evdev.c */
+    struct {
+        int written;    /* last written to the device, -1 if unknown */
+        int wanted;     /* last requested by the server */
+        BOOL pending;   /* a write is scheduled */
+        OsTimerPtr timer;
+    } leds;
+
     /* minor/major number */
     dev_t min_maj;
-
-    /* Event queue used to defer keyboard/button events until EV_SYN time. */
-    int                     num_queue;
-    EventQueueRec           queue[EVDEV_MAXQUEUE];
+    struct _EvdevRec *next_open; /* chain in the set of open devices */
 
     enum fkeymode           fkeymode;
 
     char *type_name;
+
+    /* Event queue used to defer keyboard/button events until EV_SYN time. */
+    EventQueueRec           queue[EVDEV_MAXQUEUE];
 } EvdevRec, *EvdevPtr;
 
 /* Event posting functions */
@@ -263,11 +414,12 @@ void EvdevQueueKbdEvent(InputInfoPtr pInfo, struct input_event *ev, int value);
 void EvdevQueueButtonEvent(InputInfoPtr pInfo, int button, int value);
 void EvdevQueueProximityEvent(InputInfoPtr pInfo, int value);
 void EvdevQueueTouchEvent(InputInfoPtr pInfo, unsigned int touch,
-                          ValuatorMask *mask, uint16_t type);
+                          uint64_t changed, int x, int y, uint16_t type);
 void EvdevPostButtonEvent(InputInfoPtr pInfo, int button, enum ButtonAction act);
 void EvdevQueueButtonClicks(InputInfoPtr pInfo, int button, int count);
 void EvdevPostRelativeMotionEvents(InputInfoPtr pInfo);
 void EvdevPostAbsoluteMotionEvents(InputInfoPtr pInfo);
+void EvdevProcessEvent(InputInfoPtr pInfo, struct input_event *ev);
 unsigned int EvdevUtilButtonEventToButtonNumber(EvdevPtr pEvdev, int code);
 
 /* Middle Button emulation */
@@ -292,14 +444,52 @@ void Evdev3BEmuProcessAbsMotion(InputInfoPtr pInfo, ValuatorMask *vals);
 void EvdevWheelEmuPreInit(InputInfoPtr pInfo);
 BOOL EvdevWheelEmuFilterButton(InputInfoPtr pInfo, unsigned int button, int value);
 BOOL EvdevWheelEmuFilterMotion(InputInfoPtr pInfo, struct input_event *pEv);
+void EvdevWheelEmuFinalize(InputInfoPtr pInfo);
+void EvdevWheelEmuFree(InputInfoPtr pInfo);
+
+/* Multitouch protocol A contact tracking */
+BOOL EvdevMTrackInit(InputInfoPtr pInfo);
+void EvdevMTrackEvent(InputInfoPtr pInfo, struct input_event *ev);
+void EvdevMTrackFree(InputInfoPtr pInfo);
+size_t EvdevMTrackSize(void);
+
+/* Motion prediction */
+void EvdevPredictPreInit(InputInfoPtr pInfo);
+void EvdevPredictReset(PredictorPtr p);
+BOOL EvdevPredict(EvdevPtr pEvdev, PredictorPtr p, CARD32 time, int pos[2]);
+void EvdevPredictInitProperty(DeviceIntPtr);
 
 /* Draglock code */
 void EvdevDragLockPreInit(InputInfoPtr pInfo);
+void EvdevDragLockFree(InputInfoPtr pInfo);
 BOOL EvdevDragLockFilterEvent(InputInfoPtr pInfo, unsigned int button, int value);
 
+/* Property dispatch */
+typedef int (*EvdevPropSetProc)(DeviceIntPtr dev, XIPropertyValuePtr val,
+                                BOOL checkonly);
+typedef int (*EvdevPropGetProc)(DeviceIntPtr dev);
+
+/* What a property accepts. Values are checked against type, format and
+ * size before set is called, and each value against min/max_value if
+ * min_value is below max_value. 8 and 16 bit values are unsigned, 32 bit
+ * values signed. */
+typedef struct {
+    Atom type;
+    int format;
+    int min_size, max_size;     /* number of values */
+    int min_value, max_value;
+    EvdevPropSetProc set;       /* NULL for read-only properties */
+    EvdevPropGetProc get;       /* refreshes the value before it is read */
+} EvdevPropDesc;
+
+void EvdevRegisterProperty(DeviceIntPtr dev, Atom atom,
+                           const EvdevPropDesc *desc);
+Atom EvdevInternAtom(Atom *atom, const char *name);
+
 void EvdevMBEmuInitProperty(DeviceIntPtr);
 void Evdev3BEmuInitProperty(DeviceIntPtr);
 void EvdevWheelEmuInitProperty(DeviceIntPtr);
 void EvdevDragLockInitProperty(DeviceIntPtr);
 void EvdevAppleInitProperty(DeviceIntPtr);
+void EvdevAppleFini(void);
 #endif
@@ -0,0 +1,283 @@
+/*
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of the authors
+ * not be used in advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied
+ * warranty.
+ *
+ * THE AUTHORS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+/* Multitouch protocol A contact tracking.
+ *
+ * Protocol A devices send an anonymous list of contacts per frame, each
+ * terminated by SYN_MT_REPORT. The contacts of a frame are collected here
+ * and matched against the contacts of the previous frame by distance, the
+ * result is fed to the touch pipeline as protocol B slot events.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "evdev.h"
+
+#include <xf86.h>
+
+#define MT_FIRST_CODE   ABS_MT_TOUCH_MAJOR
+#define MT_NCODES       (ABS_MAX - MT_FIRST_CODE + 1)
+#define MT_BIT(code)    (1U << ((code) - MT_FIRST_CODE))
+#define MAX_CONTACTS    EVDEV_MTRACK_MAX_CONTACTS
+
+struct contact {
+    unsigned int set;           /* MT_BIT of each code with a value */
+    int values[MT_NCODES];
+};
+
+struct mtrack {
+    struct contact frame[MAX_CONTACTS]; /* contacts of the current frame */
+    int nframe;
+    struct contact slots[MAX_CONTACTS]; /* last contact sent per slot */
+    BOOL active[MAX_CONTACTS];
+    int cur_slot;                       /* last ABS_MT_SLOT sent */
+    int tracking_id;
+};
+
+struct pair {
+    int64_t dist;
+    int contact;
+    int slot;
+};
+
+static int
+EvdevMTrackComparePairs(const void *a, const void *b)
+{
+    const struct pair *pa = a, *pb = b;
+
+    return (pa->dist > pb->dist) - (pa->dist < pb->dist);
+}
+
+static void
+EvdevMTrackPost(InputInfoPtr pInfo, struct mtrack *mt,
+                const struct timeval *time, int slot, int code, int value)
+{
+    struct input_event ev;
+
+    ev.time = *time;
+    ev.type = EV_ABS;
+
+    if (slot != mt->cur_slot) {
+        ev.code = ABS_MT_SLOT;
+        ev.value = slot;
+        EvdevProcessEvent(pInfo, &ev);
+        mt->cur_slot = slot;
+    }
+
+    ev.code = code;
+    ev.value = value;
+    EvdevProcessEvent(pInfo, &ev);
+}
+
+/**
+ * Assign the contacts of the finished frame to slots and send the
+ * resulting slot events. Contact/slot pairs are assigned greedily in
+ * order of increasing distance, left over contacts get a free slot and a
+ * new tracking ID, slots left over are ended.
+ */
+static void
+EvdevMTrackFrame(InputInfoPtr pInfo, struct mtrack *mt,
+                 const struct timeval *time)
+{
+    struct pair pairs[MAX_CONTACTS * MAX_CONTACTS];
+    int slot_of[MAX_CONTACTS];
+    BOOL taken[MAX_CONTACTS] = { FALSE };
+    int npairs = 0;
+    int i, j, code;
+
+    for (i = 0; i < mt->nframe; i++) {
+        const struct contact *c = &mt->frame[i];
+
+        slot_of[i] = -1;
+        for (j = 0; j < MAX_CONTACTS; j++) {
+            const struct contact *s = &mt->slots[j];
+            int64_t dx, dy;
+
+            if (!mt->active[j])
+                continue;
+
+            dx = c->values[ABS_MT_POSITION_X - MT_FIRST_CODE] -
+                 s->values[ABS_MT_POSITION_X - MT_FIRST_CODE];
+            dy = c->values[ABS_MT_POSITION_Y - MT_FIRST_CODE] -
+                 s->values[ABS_MT_POSITION_Y - MT_FIRST_CODE];
+            pairs[npairs].dist = dx * dx + dy * dy;
+            pairs[npairs].contact = i;
+            pairs[npairs].slot = j;
+            npairs++;
+        }
+    }
+
+    qsort(pairs, npairs, sizeof(pairs[0]), EvdevMTrackComparePairs);
+
+    for (i = 0; i < npairs; i++) {
+        if (slot_of[pairs[i].contact] != -1 || taken[pairs[i].slot])
+            continue;
+        slot_of[pairs[i].contact] = pairs[i].slot;
+        taken[pairs[i].slot] = TRUE;
+    }
+
+    for (j = 0; j < MAX_CONTACTS; j++) {
+        if (mt->active[j] && !taken[j]) {
+            EvdevMTrackPost(pInfo, mt, time, j, ABS_MT_TRACKING_ID, -1);
+            mt->active[j] = FALSE;
+        }
+    }
+
+    for (i = 0; i < mt->nframe; i++) {
+        const struct contact *c = &mt->frame[i];
+        struct contact *s;
+
+        j = slot_of[i];
+        if (j == -1) {
+            for (j = 0; j < MAX_CONTACTS; j++)
+                if (!mt->active[j] && !taken[j])
+                    break;
+
+            taken[j] = TRUE;
+            mt->active[j] = TRUE;
+            mt->slots[j].set = 0;
+            mt->tracking_id = (mt->tracking_id + 1) & 0xffff;
+            EvdevMTrackPost(pInfo, mt, time, j, ABS_MT_TRACKING_ID,
+                            mt->tracking_id);
+        }
+
+        /* only send what changed since the last frame */
+        s = &mt->slots[j];
+        for (code = MT_FIRST_CODE; code <= ABS_MAX; code++) {
+            int idx = code - MT_FIRST_CODE;
+
+            if (code == ABS_MT_TRACKING_ID || !(c->set & MT_BIT(code)))
+                continue;
+
+            if ((s->set & MT_BIT(code)) && s->values[idx] == c->values[idx])
+                continue;
+
+            EvdevMTrackPost(pInfo, mt, time, j, code, c->values[idx]);
+            s->values[idx] = c->values[idx];
+            s->set |= MT_BIT(code);
+        }
+    }
+}
+
+/**
+ * Process an event of a protocol A device. MT axis events and
+ * SYN_MT_REPORT are consumed here, everything else is passed on to
+ * EvdevProcessEvent after the slot events of a frame have been sent.
+ */
+void
+EvdevMTrackEvent(InputInfoPtr pInfo, struct input_event *ev)
+{
+    EvdevPtr pEvdev = pInfo->private;
+    struct mtrack *mt = pEvdev->mtrack;
+
+    if (ev->type == EV_ABS && ev->code >= MT_FIRST_CODE &&
+        ev->code <= ABS_MAX) {
+        if (mt->nframe < MAX_CONTACTS) {
+            struct contact *c = &mt->frame[mt->nframe];
+
+            c->values[ev->code - MT_FIRST_CODE] = ev->value;
+            c->set |= MT_BIT(ev->code);
+        }
+        return;
+    }
+
+    if (ev->type != EV_SYN)
+        goto out;
+
+    if (ev->code == SYN_MT_REPORT) {
+        if (mt->nframe < MAX_CONTACTS) {
+            struct contact *c = &mt->frame[mt->nframe];
+
+            /* contacts without a position can't be tracked */
+            if ((c->set & MT_BIT(ABS_MT_POSITION_X)) &&
+                (c->set & MT_BIT(ABS_MT_POSITION_Y)))
+                mt->nframe++;
+            else
+                c->set = 0;
+        }
+        return;
+    } else if (ev->code == SYN_REPORT) {
+        int i;
+
+        EvdevMTrackFrame(pInfo, mt, &ev->time);
+
+        for (i = 0; i < MAX_CONTACTS; i++)
+            mt->frame[i].set = 0;
+        mt->nframe = 0;
+    }
+
+out:
+    EvdevProcessEvent(pInfo, ev);
+}
+
+/**
+ * Set up contact tracking if this is a multitouch protocol A device.
+ *
+ * @return FALSE on error, TRUE if tracking was set up or the device doesn't
+ * need it
+ */
+BOOL
+EvdevMTrackInit(InputInfoPtr pInfo)
+{
+    EvdevPtr pEvdev = pInfo->private;
+
+    if (pEvdev->mtrack) {
+        pEvdev->cur_slot = pEvdev->mtrack->cur_slot;
+        return TRUE;
+    }
+
+    if (!libevdev_has_event_type(pEvdev->dev, EV_ABS))
+        return TRUE;
+
+    /* protocol B devices have slots */
+    if (libevdev_has_event_code(pEvdev->dev, EV_ABS, ABS_MT_SLOT))
+        return TRUE;
+
+    if (!libevdev_has_event_code(pEvdev->dev, EV_ABS, ABS_MT_POSITION_X) ||
+        !libevdev_has_event_code(pEvdev->dev, EV_ABS, ABS_MT_POSITION_Y))
+        return TRUE;
+
+    xf86IDrvMsg(pInfo, X_INFO, "Tracking multitouch protocol A contacts\n");
+
+    pEvdev->mtrack = calloc(1, sizeof(*pEvdev->mtrack));
+    if (!pEvdev->mtrack)
+        return FALSE;
+
+    pEvdev->cur_slot = 0;
+    return TRUE;
+}
+
+size_t
+EvdevMTrackSize(void)
+{
+    return sizeof(struct mtrack);
+}
+
+void
+EvdevMTrackFree(InputInfoPtr pInfo)
+{
+    EvdevPtr pEvdev = pInfo->private;
+
+    free(pEvdev->mtrack);
+    pEvdev->mtrack = NULL;
+}
@@ -0,0 +1,170 @@
+/*
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of the authors
+ * not be used in advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.  The authors make no
+ * representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied
+ * warranty.
+ *
+ * THE AUTHORS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+/* Motion prediction for absolute devices.
+ *
+ * An alpha-beta filter on the kernel timestamps tracks the velocity of the
+ * pointer and of each touch, the position posted is the measured position
+ * extrapolated by the prediction time. Prediction only starts after a few
+ * samples and restarts after a pause in motion, so a new touch or a pen
+ * coming back into proximity never jumps.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "evdev.h"
+
+#include <X11/Xatom.h>
+#include <xf86.h>
+#include <xf86Xinput.h>
+#include <exevents.h>
+
+#include <evdev-properties.h>
+
+#define PREDICT_MAX_TIME    50  /* ms */
+#define PREDICT_MAX_GAP     EVDEV_PREDICT_MAX_GAP
+#define PREDICT_MIN_SAMPLES 3
+#define PREDICT_ALPHA       0.75
+#define PREDICT_BETA        0.25
+#define PREDICT_MAX_STEPS   4   /* max offset in last measured steps */
+
+static Atom prop_predict = 0;
+
+void
+EvdevPredictReset(PredictorPtr p)
+{
+    p->samples = 0;
+    p->extrapolated = FALSE;
+}
+
+/**
+ * Feed the measured position into the predictor and replace it with the
+ * predicted position.
+ *
+ * @return TRUE if pos was extrapolated
+ */
+BOOL
+EvdevPredict(EvdevPtr pEvdev, PredictorPtr p, CARD32 time, int pos[2])
+{
+    int dt = time - p->time;
+    int step[2];
+    int i;
+
+    step[0] = abs(pos[0] - p->measured[0]);
+    step[1] = abs(pos[1] - p->measured[1]);
+    p->measured[0] = pos[0];
+    p->measured[1] = pos[1];
+    p->extrapolated = FALSE;
+
+    if (p->samples == 0 || dt < 0 || dt > PREDICT_MAX_GAP) {
+        for (i = 0; i < 2; i++) {
+            p->filtered[i] = pos[i];
+            p->vel[i] = 0;
+        }
+        p->time = time;
+        p->samples = 1;
+        return FALSE;
+    }
+
+    for (i = 0; i < 2; i++) {
+        double predicted = p->filtered[i] + p->vel[i] * dt;
+        double residual = pos[i] - predicted;
+
+        p->filtered[i] = predicted + PREDICT_ALPHA * residual;
+        if (dt > 0)
+            p->vel[i] += PREDICT_BETA * residual / dt;
+    }
+    p->time = time;
+    if (p->samples < PREDICT_MIN_SAMPLES)
+        p->samples++;
+
+    if (p->samples < PREDICT_MIN_SAMPLES)
+        return FALSE;
+
+    /* a short dt amplifies noise in the velocity, so the offset is
+     * bounded by the last measured movement. The transform clamps the
+     * result to the axis range. */
+    for (i = 0; i < 2; i++) {
+        double offset = p->vel[i] * pEvdev->predict.time;
+        int limit = PREDICT_MAX_STEPS * step[i];
+
+        pos[i] += (int)max(-limit, min(offset, limit));
+    }
+
+    p->extrapolated = TRUE;
+    return TRUE;
+}
+
+void
+EvdevPredictPreInit(InputInfoPtr pInfo)
+{
+    EvdevPtr pEvdev = (EvdevPtr)pInfo->private;
+    int time;
+
+    time = xf86SetIntOption(pInfo->options, "PredictionTime", 0);
+    if (time < 0 || time > PREDICT_MAX_TIME) {
+        xf86IDrvMsg(pInfo, X_WARNING, "Invalid PredictionTime value: %d\n",
+                    time);
+        xf86IDrvMsg(pInfo, X_WARNING, "Prediction disabled.\n");
+        time = 0;
+    }
+
+    pEvdev->predict.time = time;
+}
+
+static int
+EvdevPredictSetProperty(DeviceIntPtr dev, XIPropertyValuePtr val,
+                        BOOL checkonly)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
+
+    if (!checkonly)
+        pEvdev->predict.time = *((int*)val->data);
+
+    return Success;
+}
+
+static const EvdevPropDesc predict_desc =
+    { XA_INTEGER, 32, 1, 1, 0, PREDICT_MAX_TIME, EvdevPredictSetProperty, NULL };
+
+void
+EvdevPredictInitProperty(DeviceIntPtr dev)
+{
+    InputInfoPtr pInfo  = dev->public.devicePrivate;
+    EvdevPtr     pEvdev = pInfo->private;
+    int rc;
+
+    if (!(pEvdev->flags & EVDEV_ABSOLUTE_EVENTS))
+        return;
+
+    EvdevInternAtom(&prop_predict, EVDEV_PROP_PREDICTION);
+    EvdevRegisterProperty(dev, prop_predict, &predict_desc);
+    rc = XIChangeDeviceProperty(dev, prop_predict, XA_INTEGER, 32,
+                                PropModeReplace, 1, &pEvdev->predict.time,
+                                FALSE);
+    if (rc != Success)
+        return;
+
+    XISetDevicePropertyDeletable(dev, prop_predict, FALSE);
+}